@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <c8.h>
+
+/*
+ * Ahead-of-time translator: turns the code reachable from LOAD_ADDR in a
+ * .ch8 file into a C function with the same contract as c8_run.
+ *
+ * Register and timer instructions become plain C on c8_get_regs(). Anything
+ * touching the stack, the display, the keys, the sound timer, RND or memory
+ * writes is executed by the interpreter through c8_run(ctx, 1, ...). The
+ * same happens for jumps into code that was not found or whose bytes no
+ * longer match the ROM, so self-modifying code still runs correctly.
+ */
+
+#define MEM_SIZE 0x1000
+#define LOAD_ADDR 0x200
+
+#define _NNN(opcode) ((opcode) & 0xFFF)
+#define _X__(opcode) (((opcode) >> 8) & 0xF)
+#define __Y_(opcode) (((opcode) >> 4) & 0xF)
+#define __KK(opcode) ((opcode) & 0xFF)
+#define ___N(opcode) ((opcode) & 0xF)
+
+/* how control leaves an instruction */
+enum
+{
+    FLOW_NEXT,      /* falls through to the next instruction */
+    FLOW_SKIP,      /* falls through or skips the next instruction */
+    FLOW_JUMP,      /* jumps to nnn */
+    FLOW_CALL,      /* calls nnn, returns to the next instruction */
+    FLOW_END,       /* RET, JP V0 or invalid: successors unknown */
+};
+
+static uint8_t mem[MEM_SIZE];
+static uint16_t rom_end;
+static uint8_t reachable[MEM_SIZE];
+
+
+static uint16_t fetch(uint16_t address)
+{
+    return (mem[address] << 8) | mem[address + 1];
+}
+
+/**
+ * Emit the C statements for opcode at address.
+ * Returns 0 if the instruction is left to the interpreter.
+ */
+static int translate(FILE *out, uint16_t address, uint16_t opcode)
+{
+    uint8_t x = _X__(opcode);
+    uint8_t y = __Y_(opcode);
+    uint8_t kk = __KK(opcode);
+    uint16_t nnn = _NNN(opcode);
+    int i;
+
+    switch (opcode >> 12)
+    {
+        case 0x1:
+            /* a jump to itself is reported by the interpreter */
+            if (nnn == address)
+                return 0;
+            fprintf(out, "            r->pc = 0x%03X;\n", nnn);
+            fprintf(out, "            continue;\n");
+            return 1;
+        case 0x3:
+            fprintf(out, "            if (r->v[%d] == 0x%02X)\n", x, kk);
+            fprintf(out, "            {\n                r->pc = 0x%03X;\n",
+                    address + 4);
+            fprintf(out, "                continue;\n            }\n");
+            return 1;
+        case 0x4:
+            fprintf(out, "            if (r->v[%d] != 0x%02X)\n", x, kk);
+            fprintf(out, "            {\n                r->pc = 0x%03X;\n",
+                    address + 4);
+            fprintf(out, "                continue;\n            }\n");
+            return 1;
+        case 0x5:
+        case 0x9:
+            if (___N(opcode))
+                return 0;
+            fprintf(out, "            if (r->v[%d] %s r->v[%d])\n", x,
+                    opcode >> 12 == 0x5 ? "==" : "!=", y);
+            fprintf(out, "            {\n                r->pc = 0x%03X;\n",
+                    address + 4);
+            fprintf(out, "                continue;\n            }\n");
+            return 1;
+        case 0x6:
+            fprintf(out, "            r->v[%d] = 0x%02X;\n", x, kk);
+            return 1;
+        case 0x7:
+            fprintf(out, "            r->v[%d] += 0x%02X;\n", x, kk);
+            return 1;
+        case 0x8:
+            switch (___N(opcode))
+            {
+                case 0x0:
+                    fprintf(out, "            r->v[%d] = r->v[%d];\n", x, y);
+                    return 1;
+                case 0x1:
+                    fprintf(out, "            r->v[%d] |= r->v[%d];\n", x, y);
+                    return 1;
+                case 0x2:
+                    fprintf(out, "            r->v[%d] &= r->v[%d];\n", x, y);
+                    return 1;
+                case 0x3:
+                    fprintf(out, "            r->v[%d] ^= r->v[%d];\n", x, y);
+                    return 1;
+                case 0x4:
+                    fprintf(out, "            r->v[15] = r->v[%d] + r->v[%d] > 0xFF;\n",
+                            x, y);
+                    fprintf(out, "            r->v[%d] += r->v[%d];\n", x, y);
+                    return 1;
+                case 0x5:
+                    fprintf(out, "            r->v[15] = r->v[%d] > r->v[%d];\n", x, y);
+                    fprintf(out, "            r->v[%d] -= r->v[%d];\n", x, y);
+                    return 1;
+                case 0x6:
+                    fprintf(out, "            r->v[15] = r->v[%d] & 0x1;\n", y);
+                    fprintf(out, "            r->v[%d] = r->v[%d] >> 1;\n", x, y);
+                    return 1;
+                case 0x7:
+                    fprintf(out, "            r->v[15] = r->v[%d] > r->v[%d];\n", y, x);
+                    fprintf(out, "            r->v[%d] = r->v[%d] - r->v[%d];\n", x, y,
+                            x);
+                    return 1;
+                case 0xE:
+                    fprintf(out, "            r->v[15] = r->v[%d] & 0x80 ? 1 : 0;\n", y);
+                    fprintf(out, "            r->v[%d] = r->v[%d] << 1;\n", x, y);
+                    return 1;
+            }
+            return 0;
+        case 0xA:
+            fprintf(out, "            r->i = 0x%03X;\n", nnn);
+            return 1;
+        case 0xB:
+            fprintf(out, "            r->pc = r->v[0] + 0x%03X;\n", nnn);
+            fprintf(out, "            continue;\n");
+            return 1;
+        case 0xF:
+            switch (kk)
+            {
+                case 0x07:
+                    fprintf(out, "            r->v[%d] = r->delay_timer;\n", x);
+                    return 1;
+                case 0x15:
+                    fprintf(out, "            r->delay_timer = r->v[%d];\n", x);
+                    return 1;
+                case 0x1E:
+                    fprintf(out, "            r->v[15] = (uint32_t)r->i + r->v[%d] > 0xFFF;\n",
+                            x);
+                    fprintf(out, "            r->i = r->i + r->v[%d];\n", x);
+                    return 1;
+                case 0x29:
+                    fprintf(out, "            r->i = r->v[%d] * 5;\n", x);
+                    return 1;
+                case 0x65:
+                    for (i = 0; i <= x; i++)
+                        fprintf(out, "            r->v[%d] = mem[r->i++];\n", i);
+                    return 1;
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+static int flow(uint16_t opcode, uint16_t address)
+{
+    switch (opcode >> 12)
+    {
+        case 0x0:
+            if (opcode == 0x00E0)
+                return FLOW_NEXT;
+            return FLOW_END;
+        case 0x1:
+            return _NNN(opcode) == address ? FLOW_END : FLOW_JUMP;
+        case 0x2:
+            return FLOW_CALL;
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+            return FLOW_SKIP;
+        case 0xB:
+            return FLOW_END;
+        case 0xE:
+            return FLOW_SKIP;
+        default:
+            return FLOW_NEXT;
+    }
+}
+
+/**
+ * Mark everything reachable from LOAD_ADDR that lies inside the ROM.
+ */
+static void discover(void)
+{
+    static uint16_t work[MEM_SIZE];
+    unsigned int top = 0;
+
+    work[top++] = LOAD_ADDR;
+    while (top)
+    {
+        uint16_t address = work[--top];
+        uint16_t opcode;
+
+        if ((address < LOAD_ADDR) || (address + 2 > rom_end) ||
+            reachable[address])
+            continue;
+        reachable[address] = 1;
+
+        opcode = fetch(address);
+        switch (flow(opcode, address))
+        {
+            case FLOW_SKIP:
+                work[top++] = address + 4;
+                work[top++] = address + 2;
+                break;
+            case FLOW_JUMP:
+                work[top++] = _NNN(opcode);
+                break;
+            case FLOW_CALL:
+                work[top++] = _NNN(opcode);
+                work[top++] = address + 2;
+                break;
+            case FLOW_NEXT:
+                work[top++] = address + 2;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* the instruction at address falls through into the case label at +2 */
+static int falls_into_next(uint16_t address)
+{
+    return reachable[address + 2] && !reachable[address + 1];
+}
+
+static void emit(FILE *out, const char *name, int with_main)
+{
+    static uint16_t run_end[MEM_SIZE];
+    static uint8_t native[MEM_SIZE];
+    static uint8_t entered[MEM_SIZE];
+    FILE *null;
+    uint32_t address;
+
+    /* translate once to find out which instructions stay native */
+    null = fopen("/dev/null", "w");
+    if (!null)
+        return;
+    for (address = LOAD_ADDR; address + 2 <= rom_end; address++)
+        if (reachable[address])
+            native[address] = translate(null, address, fetch(address));
+    fclose(null);
+
+    /*
+     * Straight-line native runs: the bytes that have to match the ROM when
+     * entering at an address. Only instructions that fall through to the
+     * next one extend a run.
+     */
+    for (address = rom_end; address-- > LOAD_ADDR;)
+    {
+        int f;
+
+        if (!native[address])
+            continue;
+        f = flow(fetch(address), address);
+        run_end[address] = address + 2;
+        if (((f == FLOW_NEXT) || (f == FLOW_SKIP)) &&
+            falls_into_next(address) && native[address + 2])
+            run_end[address] = run_end[address + 2];
+    }
+
+    fprintf(out, "/* generated by c8aot, do not edit */\n");
+    fprintf(out, "#include <stdint.h>\n#include <string.h>\n#include <c8.h>\n\n");
+    fprintf(out, "#define LOAD_ADDR 0x%03X\n\n", LOAD_ADDR);
+
+    fprintf(out, "static const uint8_t rom[%u] = {", rom_end - LOAD_ADDR);
+    for (address = LOAD_ADDR; address < rom_end; address++)
+    {
+        if ((address - LOAD_ADDR) % 12 == 0)
+            fprintf(out, "\n       ");
+        fprintf(out, " 0x%02X,", mem[address]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out,
+            "/* the bytes of [a, a + n) differ from the translated ROM */\n"
+            "#define CHANGED(a, n) memcmp(&mem[a], &rom[(a) - LOAD_ADDR], n)\n"
+            "\n"
+            "/* count one instruction, stop at address a if out of budget */\n"
+            "#define STEP(a)                                                "
+            "                \\\n"
+            "    do                                                         "
+            "                \\\n"
+            "    {                                                          "
+            "                \\\n"
+            "        if (n == budget)                                       "
+            "                \\\n"
+            "        {                                                      "
+            "                \\\n"
+            "            r->pc = (a);                                       "
+            "                \\\n"
+            "            goto out;                                          "
+            "                \\\n"
+            "        }                                                      "
+            "                \\\n"
+            "        n++;                                                   "
+            "                \\\n"
+            "    } while (0)\n\n");
+
+    fprintf(out, "int %s_load(c8_t *ctx)\n{\n", name);
+    fprintf(out, "    int ret = c8_load(ctx, LOAD_ADDR, (uint8_t *)rom, "
+                 "sizeof(rom));\n\n");
+    fprintf(out, "    c8_set_pc(ctx, LOAD_ADDR);\n    return ret;\n}\n\n");
+
+    fprintf(out, "/*\n * Same contract as c8_run. last.pc and last.op are "
+                 "only updated by\n * instructions left to the interpreter.\n"
+                 " */\n");
+    fprintf(out, "int %s_run(c8_t *ctx, unsigned int budget, int *reason)\n{\n",
+            name);
+    fprintf(out, "    c8_regs_t *r = c8_get_regs(ctx);\n");
+    fprintf(out, "    const uint8_t *mem = c8_get_mem(ctx);\n");
+    fprintf(out, "    unsigned int n = 0;\n");
+    fprintf(out, "    int stop = STOP_BUDGET;\n\n");
+    fprintf(out, "    if (c8_halted(ctx, NULL))\n    {\n");
+    fprintf(out, "        stop = STOP_HALTED;\n        goto out;\n    }\n");
+    fprintf(out, "    while (n < budget)\n    {\n");
+    fprintf(out, "        switch (r->pc)\n        {\n");
+
+    for (address = LOAD_ADDR; address + 2 <= rom_end; address++)
+    {
+        uint16_t opcode;
+        int f;
+
+        if (!reachable[address])
+            continue;
+        opcode = fetch(address);
+        fprintf(out, "        case 0x%03X:\n", address);
+        if (!native[address])
+        {
+            fprintf(out, "            r->pc = 0x%03X;\n            break;\n",
+                    address);
+            continue;
+        }
+        fprintf(out, "            if (CHANGED(0x%03X, %u))\n                break;\n",
+                address, run_end[address] - address);
+        /* the bytes were already checked on entry to the run */
+        if (entered[address])
+            fprintf(out, "        l_%03X:\n", address);
+        fprintf(out, "            STEP(0x%03X);\n", address);
+        fprintf(out, "            r->pc = 0x%03X;\n", address + 2);
+        translate(out, address, opcode);
+
+        f = flow(opcode, address);
+        if ((f != FLOW_NEXT) && (f != FLOW_SKIP))
+            continue;
+        if (!falls_into_next(address))
+            fprintf(out, "            continue;\n");
+        else if (native[address + 2])
+        {
+            fprintf(out, "            goto l_%03X;\n", address + 2);
+            entered[address + 2] = 1;
+        }
+        else
+            fprintf(out, "            break;\n");
+    }
+
+    fprintf(out, "        default:\n            break;\n        }\n\n");
+    fprintf(out, "        /* not translated or modified since */\n");
+    fprintf(out, "        if (n == budget)\n            break;\n");
+    fprintf(out, "        n += c8_run(ctx, 1, &stop);\n");
+    fprintf(out, "        if (stop != STOP_BUDGET)\n            goto out;\n");
+    fprintf(out, "    }\n\nout:\n");
+    fprintf(out, "    if (reason)\n        *reason = stop;\n");
+    fprintf(out, "    return n;\n}\n");
+
+    if (!with_main)
+        return;
+
+    /* differential check and benchmark against the interpreter */
+    fprintf(out,
+            "\n#ifdef C8AOT_MAIN\n"
+            "#include <stdio.h>\n#include <stdlib.h>\n#include <time.h>\n\n"
+            "static double now(void)\n{\n"
+            "    struct timespec spec;\n\n"
+            "    clock_gettime(CLOCK_MONOTONIC, &spec);\n"
+            "    return spec.tv_sec + spec.tv_nsec / 1e9;\n}\n\n"
+            "static double run(c8_t *ctx, int aot, unsigned long count)\n{\n"
+            "    double start = now();\n"
+            "    unsigned long n = 0;\n    int stop, wake;\n\n"
+            "    while (n < count)\n    {\n"
+            "        n += aot ? %s_run(ctx, 1000, &stop) : "
+            "c8_run(ctx, 1000, &stop);\n"
+            "        if ((stop == STOP_INVALID_OP) || "
+            "(stop == STOP_INFINIT_LOOP))\n"
+            "            break;\n"
+            "        if (c8_halted(ctx, &wake) && !(wake & WAKE_TIMER))\n"
+            "            break;\n"
+            "        c8_tick_60hz(ctx);\n"
+            "    }\n"
+            "    return now() - start;\n}\n\n"
+            "int main(int argc, char **argv)\n{\n"
+            "    unsigned long count = argc > 1 ? strtoul(argv[1], NULL, 0) : "
+            "100000000UL;\n"
+            "    c8_t *aot = c8_create();\n"
+            "    c8_t *ref = c8_create();\n"
+            "    double t_aot, t_ref;\n"
+            "    int same;\n\n"
+            "    %s_load(aot);\n    %s_load(ref);\n"
+            "    t_aot = run(aot, 1, count);\n"
+            "    t_ref = run(ref, 0, count);\n"
+            "    same = !memcmp(c8_get_regs(aot), c8_get_regs(ref), "
+            "sizeof(c8_regs_t)) &&\n"
+            "           !memcmp(c8_get_mem(aot), c8_get_mem(ref), 0x1000);\n"
+            "    printf(\"aot: %%.2f Minstr/s, interpreter: %%.2f Minstr/s, "
+            "state %%s\\n\",\n"
+            "           count / t_aot / 1e6, count / t_ref / 1e6,\n"
+            "           same ? \"identical\" : \"DIFFERS\");\n"
+            "    c8_destroy(aot);\n    c8_destroy(ref);\n"
+            "    return same ? EXIT_SUCCESS : EXIT_FAILURE;\n}\n"
+            "#endif /* C8AOT_MAIN */\n",
+            name, name, name);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *name = "c8aot";
+    const char *output = NULL;
+    FILE *in, *out;
+    size_t nbytes;
+    int with_main = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "mn:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                with_main = 1;
+                break;
+            case 'n':
+                name = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        printf("usage:\n\t%s [-n name] [-o out.c] [-m] <rom.ch8>\n", argv[0]);
+        return -1;
+    }
+
+    in = fopen(argv[optind], "rb");
+    if (!in)
+    {
+        printf("File '%s' not found\n", argv[optind]);
+        return ERR_FILE_NOT_FOUND;
+    }
+    nbytes = fread(&mem[LOAD_ADDR], 1, MEM_SIZE - LOAD_ADDR, in);
+    fclose(in);
+    rom_end = LOAD_ADDR + nbytes;
+
+    out = output ? fopen(output, "w") : stdout;
+    if (!out)
+    {
+        printf("Cannot write '%s'\n", output);
+        return -1;
+    }
+
+    discover();
+    emit(out, name, with_main);
+
+    if (output)
+        fclose(out);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <c8.h>
+
+#define LOAD_ADDR 0x200
+#define DEFAULT_COUNT 50000000UL
+#define DEFAULT_BUDGET 1000
+#define RENDER_WARMUP 100000UL
+#define RENDER_FRAMES 100000UL
+#define STATE_COUNT 100000UL
+
+/*
+ * Synthetic workload used when no ROM is given: a tight ALU loop that also
+ * touches the Fxxx group, so decode cost shows up for every opcode group.
+ */
+static uint8_t bench_rom[] = {
+        0xA3, 0x00, // 200: LD I, 0x300
+        0xF0, 0x65, // 202: LD V0, [I]
+        0x73, 0x01, // 204: ADD V3, 0x01
+        0x84, 0x34, // 206: ADD V4, V3
+        0x85, 0x43, // 208: XOR V5, V4
+        0x33, 0x00, // 20a: SE V3, 0x00
+        0x12, 0x00, // 20c: JP 0x200
+        0x12, 0x00, // 20e: JP 0x200
+};
+
+
+static uint64_t get_us()
+{
+    struct timespec spec;
+    uint64_t us;
+
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    us = spec.tv_sec * 1e6 + spec.tv_nsec / 1e3;
+    return us;
+}
+
+/**
+ * A halted CPU only moves on with time passing: tick the timers if that
+ * wakes it up, give up if not.
+ */
+static int bench_halted(c8_t *ctx, unsigned long n)
+{
+    int wake;
+
+    if (!c8_halted(ctx, &wake))
+        return 0;
+    if (wake & WAKE_TIMER)
+    {
+        c8_tick_60hz(ctx);
+        return 0;
+    }
+    fprintf(stderr, "Program halted after %lu instructions\n", n);
+    return -1;
+}
+
+static int bench_step(c8_t *ctx, unsigned long count)
+{
+    unsigned long n;
+
+    for (n = 0; n < count; n++)
+    {
+        if (bench_halted(ctx, n))
+            return -1;
+        if (c8_step(ctx) == ERR_INVALID_OP)
+        {
+            uint16_t op, pc;
+            (void)c8_debug_get_last(ctx, &op, &pc);
+            fprintf(stderr, "Illegal instruction %04x at %04x\n", op, pc);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int bench_run(c8_t *ctx, unsigned long count, unsigned int budget)
+{
+    unsigned long n = 0;
+    int stop;
+
+    while (n < count)
+    {
+        n += c8_run(ctx, count - n < budget ? count - n : budget, &stop);
+        if (stop == STOP_INVALID_OP)
+        {
+            uint16_t op, pc;
+            (void)c8_debug_get_last(ctx, &op, &pc);
+            fprintf(stderr, "Illegal instruction %04x at %04x\n", op, pc);
+            return -1;
+        }
+        if (bench_halted(ctx, n))
+            return -1;
+    }
+    return 0;
+}
+
+/* whole frames through c8_render_display against c8_get_pixel polling */
+static int bench_render(c8_t *ctx, unsigned long count)
+{
+    static uint32_t pixels[C8_HEIGHT * C8_WIDTH];
+    const uint32_t palette[2] = {0xFF000000, 0xFFFFFFFF};
+    unsigned long n;
+    uint64_t start;
+    int x, y;
+
+    start = get_us();
+    for (n = 0; n < count; n++)
+        for (y = 0; y < C8_HEIGHT; y++)
+            for (x = 0; x < C8_WIDTH; x++)
+                pixels[y * C8_WIDTH + x] = palette[c8_get_pixel(ctx, x, y)];
+    printf("c8_get_pixel: %.3f us/frame\n", (double)(get_us() - start) / count);
+
+    start = get_us();
+    for (n = 0; n < count; n++)
+        c8_render_display(ctx, pixels, sizeof(uint32_t) * C8_WIDTH,
+                          C8_FORMAT_32, palette);
+    printf("c8_render_display: %.3f us/frame\n",
+           (double)(get_us() - start) / count);
+    return 0;
+}
+
+/* save and load states of whatever the program did in its first instructions */
+static int bench_state(c8_t *ctx, unsigned long count)
+{
+    uint8_t *state = malloc(c8_state_size());
+    unsigned long n;
+    uint64_t start;
+
+    if (!state)
+        return ERR_OUT_OF_MEM;
+
+    start = get_us();
+    for (n = 0; n < count; n++)
+        c8_save_state(ctx, state);
+    printf("c8_save_state: %.3f us, %lu bytes\n",
+           (double)(get_us() - start) / count,
+           (unsigned long)c8_state_size());
+
+    start = get_us();
+    for (n = 0; n < count; n++)
+        c8_load_state(ctx, state);
+    printf("c8_load_state: %.3f us\n", (double)(get_us() - start) / count);
+
+    free(state);
+    return 0;
+}
+
+/* fork the machine, against a new one loading its saved state */
+static int bench_clone(c8_t *ctx, unsigned long count)
+{
+    uint8_t *state = malloc(c8_state_size());
+    void *mem = malloc(c8_size());
+    c8_t *dst = c8_create();
+    unsigned long n;
+    uint64_t start;
+
+    if (!state || !mem || !dst)
+    {
+        free(state);
+        free(mem);
+        c8_destroy(dst);
+        return ERR_OUT_OF_MEM;
+    }
+
+    start = get_us();
+    for (n = 0; n < count; n++)
+        c8_clone(dst, ctx);
+    printf("c8_clone: %.3f us, %lu bytes\n",
+           (double)(get_us() - start) / count, (unsigned long)c8_size());
+
+    start = get_us();
+    for (n = 0; n < count; n++)
+        (void)c8_clone_into(mem, ctx);
+    printf("c8_clone_into: %.3f us\n", (double)(get_us() - start) / count);
+
+    c8_save_state(ctx, state);
+    start = get_us();
+    for (n = 0; n < count; n++)
+    {
+        c8_t *other = c8_create();
+
+        if (other)
+            c8_load_state(other, state);
+        c8_destroy(other);
+    }
+    printf("c8_create + c8_load_state: %.3f us\n",
+           (double)(get_us() - start) / count);
+
+    free(state);
+    free(mem);
+    c8_destroy(dst);
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    c8_t *ctx;
+    unsigned long count = DEFAULT_COUNT;
+    unsigned int budget = DEFAULT_BUDGET;
+    const char *mode = "step";
+    uint64_t start, elapsed;
+    int jit = 0;
+    int opt, res;
+    int ret = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "b:jm:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                budget = strtoul(optarg, NULL, 0);
+                break;
+            case 'j':
+                jit = 1;
+                break;
+            case 'm':
+                mode = optarg;
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                printf("usage:\n\t%s [-m step|run|render|state|clone] [-b budget] "
+                       "[-j] [-n instructions] [rom.ch8]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (budget == 0)
+        budget = 1;
+
+    ctx = c8_create();
+    if (!ctx)
+        return ERR_OUT_OF_MEM;
+
+    if (optind < argc)
+    {
+        if (c8_load_file(ctx, argv[optind]) == ERR_FILE_NOT_FOUND)
+        {
+            printf("File '%s' not found\n", argv[optind]);
+            ret = ERR_FILE_NOT_FOUND;
+            goto end;
+        }
+    }
+    else
+    {
+        c8_load(ctx, LOAD_ADDR, bench_rom, sizeof(bench_rom));
+        c8_set_pc(ctx, LOAD_ADDR);
+    }
+
+    if (jit && (c8_set_jit(ctx, 1) != ERR_OK))
+    {
+        printf("JIT not available\n");
+        ret = ERR_NOT_SUPPORTED;
+        goto end;
+    }
+
+    start = get_us();
+    if (!strcmp(mode, "run"))
+        res = bench_run(ctx, count, budget);
+    else if (!strcmp(mode, "step"))
+        res = bench_step(ctx, count);
+    else if (!strcmp(mode, "render"))
+    {
+        /* frames of whatever the program drew in its first instructions */
+        (void)bench_run(ctx, RENDER_WARMUP, budget);
+        ret = bench_render(ctx, RENDER_FRAMES);
+        goto end;
+    }
+    else if (!strcmp(mode, "state"))
+    {
+        (void)bench_run(ctx, RENDER_WARMUP, budget);
+        ret = bench_state(ctx, STATE_COUNT);
+        goto end;
+    }
+    else if (!strcmp(mode, "clone"))
+    {
+        (void)bench_run(ctx, RENDER_WARMUP, budget);
+        ret = bench_clone(ctx, STATE_COUNT);
+        goto end;
+    }
+    else
+    {
+        printf("Unknown mode '%s'\n", mode);
+        ret = -1;
+        goto end;
+    }
+    if (res)
+    {
+        ret = ERR_INVALID_OP;
+        goto end;
+    }
+    elapsed = get_us() - start;
+    if (elapsed == 0)
+        elapsed = 1;
+
+    printf("%s: %lu instructions in %.3f s, %.2f Minstr/s\n", mode, count,
+           elapsed / 1e6, (double)count / elapsed);
+    printf("fused pairs: %llu, idle instructions skipped: %llu\n",
+           (unsigned long long)c8_get_stats(ctx)->fused,
+           (unsigned long long)c8_get_stats(ctx)->idle_skipped);
+
+end:
+    c8_destroy(ctx);
+    return ret;
+}
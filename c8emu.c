@@ -2,6 +2,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <c8.h>
+#include "scale.h"
+#include "rewind.h"
+#include "movie.h"
 
 // http://gigi.nullneuron.net/gigilabs/sdl2-pixel-drawing/
 
@@ -9,7 +12,6 @@
 /*
  * TODO:
  * - sound
- * - graphics scaling
  * - SuperChip8 support
  */
 
@@ -22,6 +24,12 @@ enum
 
 #define BIT(n) (1 << (n))
 
+/* default memory for rewinding, in KB */
+#define REWIND_KB 1024
+
+/* most frames to run ahead */
+#define AHEAD_MAX 8
+
 #define COLOR 0x00008000
 
 #ifdef HIRES
@@ -47,68 +55,197 @@ static uint64_t get_us()
 }
 
 
+/* run the instructions of one frame, returns -1 on an illegal one */
+static int run_frame(c8_t *ctx, int budget)
+{
+    int stop;
+
+    while (budget > 0)
+    {
+        budget -= c8_run(ctx, budget, &stop);
+        if (stop == STOP_INVALID_OP)
+            return -1;
+        /* nothing changes until the next frame */
+        if ((stop == STOP_INFINIT_LOOP) || (stop == STOP_KEY_WAIT) ||
+            (stop == STOP_HALTED))
+            break;
+    }
+    return 0;
+}
+
+
 int main(int argc, char **argv)
 {
     SDL_Window *window = NULL;
     SDL_Renderer *renderer = NULL;
     SDL_Texture *texture = NULL;
-    uint32_t *framebuffer = NULL;
     c8_t *ctx = NULL;
-    uint64_t nextvsync;
+    uint64_t nextvsync, start;
     char window_title[256] = "\0";
     int trace = 0;
     uint16_t keys = 0;
+    const uint32_t palette[2] = {0x0, COLOR};
+    int redraw = 1;
+    uint64_t present_us = 0;
+    unsigned long frames = 0;
+    int filter = -1, factor = 1, opt;
+    c8_rect_t dirty;
+    int uploaded = 0;
+    rewind_t *rw = NULL;
+    unsigned long rewind_kb = REWIND_KB;
+    int rewinding = 0;
+    uint64_t push_us = 0, pop_us = 0;
+    unsigned long pushes = 0, pops = 0;
+    const char *record = NULL, *play = NULL;
+    movie_t *movie = NULL;
+    uint16_t played = 0;
+    unsigned long ahead = 0;
+    void *snapshot = NULL;
+    uint64_t ahead_us = 0;
+    unsigned long aheads = 0;
     SDL_Rect display = {.x = 0, .y = 0, .w = WIDTH * SCALE, .h = HEIGHT * SCALE};
 
-    if (argc != 2)
+    while ((opt = getopt(argc, argv, "a:f:p:r:w:")) != -1)
     {
-        printf("usage:\n\t%s <rom.ch8>\n", argv[0]);
+        if (opt == 'r')
+            rewind_kb = strtoul(optarg, NULL, 0);
+        else if (opt == 'a')
+            ahead = strtoul(optarg, NULL, 0);
+        else if (opt == 'p')
+            play = optarg;
+        else if (opt == 'w')
+            record = optarg;
+        else if ((opt != 'f') || scale_parse(optarg, &filter, &factor))
+        {
+            optind = argc;
+            break;
+        }
+    }
+    if ((optind != argc - 1) || (play && record) || (ahead > AHEAD_MAX))
+    {
+        printf("usage:\n\t%s [-f 1x..8x|epx|scale2x|scale3x] "
+               "[-r rewind KB, 0 for none] [-a run ahead frames, 0 to %d] "
+               "[-w record movie | -p play movie] <rom.ch8>\n", argv[0],
+               AHEAD_MAX);
         return -1;
     }
 
     ctx = c8_create();
-    if (c8_load_file(ctx, argv[1]) == ERR_FILE_NOT_FOUND)
+    if (c8_load_file(ctx, argv[optind]) == ERR_FILE_NOT_FOUND)
     {
-        printf("File '%s' not found\n", argv[1]);
+        printf("File '%s' not found\n", argv[optind]);
         return ERR_FILE_NOT_FOUND;
     }
-    snprintf(window_title, 255, TITLE, argv[0], argv[1]);
+    snprintf(window_title, 255, TITLE, argv[0], argv[optind]);
+
+    /*
+     * Movies replay the frames as they were played, so there is no going
+     * back while one is recorded or played.
+     */
+    if (play)
+    {
+        uint64_t seed, hash;
+        unsigned int ipf;
+
+        movie = movie_open(play);
+        if (!movie)
+        {
+            printf("Cannot play '%s'\n", play);
+            return ERR_FILE_NOT_FOUND;
+        }
+        movie_info(movie, &seed, &hash, &ipf);
+        if ((hash != movie_hash(ctx)) || (ipf != CLOCKSPEED_480Hz))
+        {
+            printf("'%s' was not recorded with this ROM\n", play);
+            return -1;
+        }
+        c8_set_seed(ctx, seed);
+    }
+    else
+    {
+        uint64_t seed = time(NULL) ^ get_us();
+
+        c8_set_seed(ctx, seed);
+        if (record)
+        {
+            movie = movie_create(record, seed, movie_hash(ctx),
+                                 CLOCKSPEED_480Hz);
+            if (!movie)
+            {
+                printf("Cannot write '%s'\n", record);
+                return ERR_FILE_NOT_FOUND;
+            }
+        }
+    }
+    if (rewind_kb && !movie)
+        rw = rewind_create(rewind_kb * 1024);
+    if (ahead && !(snapshot = malloc(c8_state_size())))
+        ahead = 0;
 
     SDL_Init(SDL_INIT_VIDEO);
     window = SDL_CreateWindow(window_title, SDL_WINDOWPOS_UNDEFINED,
                               SDL_WINDOWPOS_UNDEFINED, WIDTH * SCALE,
                               HEIGHT * SCALE, 0);
     renderer = SDL_CreateRenderer(window, -1, 0);
+    /* the renderer stretches whatever is left between texture and window */
     texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                SDL_TEXTUREACCESS_STATIC, WIDTH, HEIGHT);
-
-    framebuffer = malloc(WIDTH * HEIGHT * sizeof(uint32_t));
-    memset(framebuffer, 0, WIDTH * HEIGHT * sizeof(uint32_t));
+                                SDL_TEXTUREACCESS_STREAMING, WIDTH * factor,
+                                HEIGHT * factor);
 
     nextvsync = get_us();
     while (6 != 9)
     {
-        int i;
+        int budget = CLOCKSPEED_480Hz;
         SDL_Event event;
+        c8_regs_t *regs;
 
-        for (i = 0; i < CLOCKSPEED_480Hz; i++)
+        /* holding the rewind key plays the recorded frames backwards */
+        if (rewinding && rw)
         {
-            int res = c8_step(ctx);
-            if (res == ERR_INVALID_OP)
+            start = get_us();
+            if (!rewind_pop(rw, ctx))
             {
-                uint16_t op, pc;
-                (void)c8_debug_get_last(ctx, &op, &pc);
-                printf("Illegal instruction %04x at %04x\n", op, pc);
-                goto end;
+                pop_us += get_us() - start;
+                pops++;
             }
+            budget = 0;
+        }
+        if (play && movie_play(movie, &played))
+        {
+            printf("Replay finished\n");
+            goto end;
         }
 
-        SDL_PollEvent(&event);
+        if (run_frame(ctx, budget))
+        {
+            uint16_t op, pc;
+            (void)c8_debug_get_last(ctx, &op, &pc);
+            printf("Illegal instruction %04x at %04x\n", op, pc);
+            goto end;
+        }
+
+        /*
+         * A halted CPU with the timers stopped only moves on with input:
+         * sleep until there is some instead of polling every frame.
+         */
+        regs = c8_get_regs(ctx);
+        if (c8_halted(ctx, NULL) && !regs->delay_timer &&
+            !regs->sound_timer && !rewinding && !play)
+        {
+            if (!SDL_WaitEvent(&event))
+                goto end;
+            nextvsync = get_us();
+        }
+        else if (!SDL_PollEvent(&event))
+            event.type = 0;
         switch (event.type)
         {
             case SDL_QUIT:
                 goto end;
                 break;
+            case SDL_WINDOWEVENT:
+                redraw = 1;
+                break;
             case SDL_KEYDOWN:
                 /*
                     |1|2|3|C|  =>  |1|2|3|4|
@@ -138,6 +275,9 @@ int main(int argc, char **argv)
                         trace = (trace + 1) & 1;
                         c8_debug_set_trace(ctx, trace);
                         break;
+                    case SDLK_BACKSPACE:
+                        rewinding = (rw != NULL);
+                        break;
                     case SDLK_ESCAPE:
                         goto end;
                         break;
@@ -162,10 +302,18 @@ int main(int argc, char **argv)
                     case SDLK_r:    keys &= ~BIT(13);    break;
                     case SDLK_f:    keys &= ~BIT(14);    break;
                     case SDLK_v:    keys &= ~BIT(15);    break;
+                    case SDLK_BACKSPACE:
+                        rewinding = 0;
+                        break;
                 }
                 break;
         }
-        c8_set_keys(ctx, keys);
+        if (play)
+            c8_set_keys(ctx, played);
+        else
+            c8_set_keys(ctx, keys);
+        if (record)
+            movie_record(movie, keys);
 
         /* wait for vertical sync (60 Hz) */
         do
@@ -173,26 +321,145 @@ int main(int argc, char **argv)
             usleep(500);
         } while (get_us() < nextvsync);
 
-        c8_tick_60hz(ctx);
+        if (!rewinding)
+        {
+            c8_tick_60hz(ctx);
+            if (rw)
+            {
+                start = get_us();
+                rewind_push(rw, ctx);
+                push_us += get_us() - start;
+                pushes++;
+            }
+        }
         nextvsync += 16667;
 
-        int x, y;
-        for (y = 0; y < HEIGHT; y++)
-            for (x = 0; x < WIDTH; x++)
-                if (c8_get_pixel(ctx, x, y))
-                    framebuffer[y * WIDTH + x] = COLOR;
+        /*
+         * Run ahead: show the frame that is ahead frames away with the keys
+         * held now, then go back. Games that take a few frames to react to
+         * a key then react on the next frame shown.
+         */
+        if (ahead && !rewinding)
+        {
+            unsigned long n;
+
+            start = get_us();
+            c8_save_state(ctx, snapshot);
+            for (n = 0; n < ahead; n++)
+            {
+                if (run_frame(ctx, CLOCKSPEED_480Hz))
+                    break;
+                c8_tick_60hz(ctx);
+            }
+            ahead_us += get_us() - start;
+        }
+
+        /* most frames do not touch the display */
+        start = get_us();
+        if (c8_get_dirty(ctx, &dirty, NULL) || !uploaded)
+        {
+            SDL_Rect area;
+            void *pixels;
+            int pitch;
+
+            /*
+             * The first upload covers the whole texture, later ones what
+             * changed. The filters redraw the neighbours of a changed pixel.
+             */
+            if (!uploaded)
+            {
+                dirty.x = dirty.y = 0;
+                dirty.w = WIDTH;
+                dirty.h = HEIGHT;
+            }
+            else if (filter > SCALE_NEAREST)
+            {
+                int x1 = SDL_min(dirty.x + dirty.w + 1, WIDTH);
+                int y1 = SDL_min(dirty.y + dirty.h + 1, HEIGHT);
+
+                dirty.x = SDL_max(dirty.x - 1, 0);
+                dirty.y = SDL_max(dirty.y - 1, 0);
+                dirty.w = x1 - dirty.x;
+                dirty.h = y1 - dirty.y;
+            }
+            area.x = dirty.x * factor;
+            area.y = dirty.y * factor;
+            area.w = dirty.w * factor;
+            area.h = dirty.h * factor;
+
+            /*
+             * Only that area is locked and expanded straight into the
+             * texture. A locked texture holds undefined pixels, so all of
+             * the area is written. The pointer is moved back to the origin
+             * of the image.
+             */
+            if (SDL_LockTexture(texture, &area, &pixels, &pitch) == 0)
+            {
+                uint8_t *image = (uint8_t *)pixels - area.y * pitch -
+                                 area.x * (int)sizeof(uint32_t);
+
+                if (filter < 0)
+                    c8_render_rect(ctx, image, pitch, C8_FORMAT_32, palette,
+                                   &dirty);
                 else
-                    framebuffer[y * WIDTH + x] = 0x0;
+                {
+                    uint64_t rows[HEIGHT];
+
+                    c8_get_display(ctx, rows);
+                    scale_rect(rows, image, pitch, filter, factor, palette,
+                               &dirty);
+                }
+                SDL_UnlockTexture(texture);
+                uploaded = 1;
+            }
+            redraw = 1;
+        }
+        if (ahead && !rewinding)
+        {
+            uint64_t back = get_us();
+
+            (void)c8_load_state(ctx, snapshot);
+            ahead_us += get_us() - back;
+            start += get_us() - back;
+            aheads++;
+        }
+        if (!redraw)
+            continue;
+        redraw = 0;
 
-        SDL_UpdateTexture(texture, NULL, framebuffer, WIDTH * sizeof(uint32_t));
         SDL_RenderClear(renderer);
         SDL_RenderCopy(renderer, texture, NULL, &display);
         SDL_RenderPresent(renderer);
+        present_us += get_us() - start;
+        frames++;
     }
 
 end:
-    if (framebuffer)
-        free(framebuffer);
+    if (movie)
+    {
+        printf("state %016llx\n", (unsigned long long)movie_state_hash(ctx));
+        if (movie_close(movie) && record)
+            printf("Cannot write '%s'\n", record);
+    }
+    if (frames)
+        printf("%lu frames presented, %.1f us/frame\n", frames,
+               (double)present_us / frames);
+    if (rw)
+    {
+        unsigned int kept;
+        size_t bytes;
+
+        rewind_stats(rw, &kept, &bytes);
+        printf("rewind: %u frames in %lu KB, push %.2f us, pop %.2f us\n",
+               kept, (unsigned long)(bytes / 1024),
+               pushes ? (double)push_us / pushes : 0.0,
+               pops ? (double)pop_us / pops : 0.0);
+        rewind_destroy(rw);
+    }
+    if (aheads)
+        printf("run ahead: %lu frames, %.2f us/frame\n", ahead,
+               (double)ahead_us / aheads);
+    free(snapshot);
     if (texture)
         SDL_DestroyTexture(texture);
     if (renderer)
@@ -200,7 +467,7 @@ end:
     if (window)
         SDL_DestroyWindow(window);
     if (ctx)
-        free(ctx);
+        c8_destroy(ctx);
     SDL_Quit();
 
     return EXIT_SUCCESS;
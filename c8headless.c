@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <c8.h>
+#include "movie.h"
+#include "term.h"
+
+#define DEFAULT_FRAMES 3600UL
+#define DEFAULT_IPF 8
+
+/*
+ * Runs a ROM without a display, as fast as the host allows, and writes
+ * the 60 Hz frames as a stream of raw PBM (P4) images or as a Y4M video.
+ *
+ * A frame is only written once the display changed again, together with
+ * the number of 60 Hz frames it stayed on screen: a "# repeat N" comment
+ * in the PBM header, an "Xrepeat=N" parameter in the Y4M frame header.
+ * With -a every frame is written, which plays back at the right speed in
+ * any Y4M player.
+ *
+ * The term format draws into the terminal instead, in braille characters,
+ * at the real 60 Hz.
+ *
+ * With -p a movie recorded by c8emu is played back: its keys are pressed
+ * frame by frame, and a hash of the final state is printed, which matches
+ * between runs when the replay is exact.
+ */
+
+static uint64_t get_us()
+{
+    struct timespec spec;
+    uint64_t us;
+
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    us = spec.tv_sec * 1e6 + spec.tv_nsec / 1e3;
+    return us;
+}
+
+static void write_pbm(FILE *out, const uint64_t *rows, unsigned long repeat)
+{
+    uint8_t line[C8_WIDTH / 8];
+    int y, b;
+
+    fprintf(out, "P4\n# repeat %lu\n%d %d\n", repeat, C8_WIDTH, C8_HEIGHT);
+    for (y = 0; y < C8_HEIGHT; y++)
+    {
+        /* same bit order as the display: x = 0 in the top bit */
+        for (b = 0; b < C8_WIDTH / 8; b++)
+            line[b] = rows[y] >> (C8_WIDTH - 8 - 8 * b);
+        fwrite(line, sizeof(line), 1, out);
+    }
+}
+
+static void write_y4m(FILE *out, const uint8_t *luma, unsigned long repeat)
+{
+    if (repeat > 1)
+        fprintf(out, "FRAME Xrepeat=%lu\n", repeat);
+    else
+        fprintf(out, "FRAME\n");
+    fwrite(luma, C8_WIDTH * C8_HEIGHT, 1, out);
+}
+
+/* write a frame shown for repeat frames, returns how many were written */
+static unsigned long write_frame(FILE *out, int y4m, const uint64_t *rows,
+                                 const uint8_t *luma, unsigned long repeat,
+                                 int all)
+{
+    unsigned long n, count = all ? repeat : 1;
+
+    for (n = 0; n < count; n++)
+    {
+        if (y4m)
+            write_y4m(out, luma, all ? 1 : repeat);
+        else
+            write_pbm(out, rows, all ? 1 : repeat);
+    }
+    return count;
+}
+
+
+int main(int argc, char **argv)
+{
+    static const uint32_t palette[2] = {0x00, 0xFF};
+    static uint8_t luma[C8_HEIGHT * C8_WIDTH];
+    uint64_t rows[C8_HEIGHT];
+    unsigned long frames = DEFAULT_FRAMES;
+    unsigned long frame, written = 0, repeat = 0;
+    unsigned int ipf = DEFAULT_IPF;
+    const char *format = "pbm";
+    const char *output = NULL;
+    const char *play = NULL;
+    movie_t *movie = NULL;
+    uint64_t seed, hash;
+    int all = 0, nframes = 0;
+    int opt, y4m, tty;
+    term_t term;
+    uint64_t nextvsync;
+    FILE *out = stdout;
+    uint64_t start, elapsed;
+    c8_t *ctx;
+
+    while ((opt = getopt(argc, argv, "af:i:n:o:p:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'a':
+                all = 1;
+                break;
+            case 'f':
+                format = optarg;
+                break;
+            case 'i':
+                ipf = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                frames = strtoul(optarg, NULL, 0);
+                nframes = 1;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'p':
+                play = optarg;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    y4m = !strcmp(format, "y4m");
+    tty = !strcmp(format, "term");
+    if ((optind != argc - 1) || (!y4m && !tty && strcmp(format, "pbm")))
+    {
+        printf("usage:\n\t%s [-f pbm|y4m|term] [-o out] [-n frames] "
+               "[-i instructions per frame] [-p movie] [-a] <rom.ch8>\n", argv[0]);
+        return -1;
+    }
+
+    ctx = c8_create();
+    if (!ctx)
+        return ERR_OUT_OF_MEM;
+    if (c8_load_file(ctx, argv[optind]) == ERR_FILE_NOT_FOUND)
+    {
+        fprintf(stderr, "File '%s' not found\n", argv[optind]);
+        return ERR_FILE_NOT_FOUND;
+    }
+    if (play)
+    {
+        movie = movie_open(play);
+        if (!movie)
+        {
+            fprintf(stderr, "Cannot play '%s'\n", play);
+            return ERR_FILE_NOT_FOUND;
+        }
+        movie_info(movie, &seed, &hash, &ipf);
+        if (hash != movie_hash(ctx))
+        {
+            fprintf(stderr, "'%s' was not recorded with this ROM\n", play);
+            return -1;
+        }
+        c8_set_seed(ctx, seed);
+        /* the whole movie, unless told otherwise */
+        if (!nframes)
+            frames = ULONG_MAX;
+    }
+    if (output && !(out = fopen(output, "wb")))
+    {
+        fprintf(stderr, "Cannot open '%s'\n", output);
+        return ERR_FILE_NOT_FOUND;
+    }
+    if (y4m)
+        fprintf(out, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", C8_WIDTH,
+                C8_HEIGHT);
+    if (tty)
+        term_init(&term, out);
+
+    start = get_us();
+    nextvsync = start;
+    for (frame = 0; frame < frames; frame++)
+    {
+        unsigned int budget = ipf;
+        c8_regs_t *regs;
+        uint16_t keys;
+        int stop, wake;
+
+        if (movie && movie_play(movie, &keys))
+        {
+            frames = frame;
+            break;
+        }
+
+        while (budget > 0)
+        {
+            budget -= c8_run(ctx, budget, &stop);
+            if (stop == STOP_INVALID_OP)
+            {
+                uint16_t op, pc;
+                (void)c8_debug_get_last(ctx, &op, &pc);
+                fprintf(stderr, "Illegal instruction %04x at %04x\n", op, pc);
+                frames = frame;
+                break;
+            }
+            if ((stop == STOP_INFINIT_LOOP) || (stop == STOP_KEY_WAIT) ||
+                (stop == STOP_HALTED))
+                break;
+        }
+
+        if (tty)
+        {
+            if (c8_get_dirty(ctx, NULL, NULL) || !frame)
+            {
+                c8_get_display(ctx, rows);
+                term_frame(&term, rows, out);
+                written++;
+            }
+            nextvsync += 16667;
+            while (get_us() < nextvsync)
+                usleep(500);
+        }
+        else
+        {
+            /* a frame changed since the last one, flush the last one */
+            if ((c8_get_dirty(ctx, NULL, NULL) || all) && repeat)
+            {
+                written += write_frame(out, y4m, rows, luma, repeat, all);
+                repeat = 0;
+            }
+            if (!repeat)
+            {
+                c8_get_display(ctx, rows);
+                if (y4m)
+                    c8_render_display(ctx, luma, C8_WIDTH, C8_FORMAT_8,
+                                      palette);
+            }
+            repeat++;
+        }
+
+        if (movie)
+            c8_set_keys(ctx, keys);
+
+        /* nothing can wake the CPU without input: the rest is this frame */
+        regs = c8_get_regs(ctx);
+        if (!movie && c8_halted(ctx, &wake))
+        {
+            int timers = regs->delay_timer || regs->sound_timer;
+
+            if (!(wake & WAKE_TIMER) || !timers)
+            {
+                if (repeat)
+                    repeat += frames - frame - 1;
+                break;
+            }
+        }
+        c8_tick_60hz(ctx);
+    }
+    if (repeat)
+        written += write_frame(out, y4m, rows, luma, repeat, all);
+    if (tty)
+        term_end(&term, out);
+    elapsed = get_us() - start;
+    if (elapsed == 0)
+        elapsed = 1;
+
+    fprintf(stderr, "%lu frames, %lu written, %.3f s, %.0fx real time\n",
+            frames, written, elapsed / 1e6,
+            frames / 60.0 / (elapsed / 1e6));
+    if (movie)
+    {
+        fprintf(stderr, "state %016llx\n",
+                (unsigned long long)movie_state_hash(ctx));
+        movie_close(movie);
+    }
+
+    if (out != stdout)
+        fclose(out);
+    c8_destroy(ctx);
+    return EXIT_SUCCESS;
+}
@@ -2,6 +2,7 @@
 #define C8_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,10 +15,82 @@ extern "C" {
 #define ERR_INFINIT_LOOP -2
 #define ERR_OUT_OF_MEM -3
 #define ERR_FILE_NOT_FOUND -4
+#define ERR_NOT_SUPPORTED -5
+#define ERR_HALTED -6
+#define ERR_BAD_STATE -7
+
+/* reasons for c8_run to return */
+#define STOP_BUDGET 0
+#define STOP_INVALID_OP 1
+#define STOP_INFINIT_LOOP 2
+#define STOP_DISPLAY 3
+#define STOP_SOUND 4
+#define STOP_KEY_WAIT 5
+#define STOP_HALTED 6
+
+/* display size in pixels */
+#define C8_WIDTH 64
+#define C8_HEIGHT 32
+
+/* pixel formats for c8_render_display, by bytes per pixel */
+#define C8_FORMAT_8 1
+#define C8_FORMAT_16 2
+#define C8_FORMAT_32 4
+
+/* area of the display, in pixels */
+typedef struct
+{
+    int x;
+    int y;
+    int w;
+    int h;
+} c8_rect_t;
+
+/* what ends a halt, see c8_halted */
+#define WAKE_NONE 0
+#define WAKE_TIMER 1
+#define WAKE_KEY 2
 
 
 typedef struct c8 c8_t;
 
+/* CPU registers, see c8_get_regs */
+typedef struct
+{
+    uint16_t pc;
+    uint16_t i;
+    uint8_t v[16];
+    uint8_t sp;
+    uint8_t sound_timer;
+    uint8_t delay_timer;
+} c8_regs_t;
+
+/* execution counters, see c8_get_stats */
+typedef struct
+{
+    uint64_t fused;
+    uint64_t idle_skipped;
+} c8_stats_t;
+
+/* display events, see c8_set_draw_callback */
+#define C8_DRAW_CLS 0
+#define C8_DRAW_SPRITE 1
+
+typedef struct
+{
+    int type;
+    /* top left corner, wrapped into the display */
+    uint8_t x;
+    uint8_t y;
+    /* lines of the sprite, one byte each with the leftmost pixel on top */
+    uint8_t n;
+    const uint8_t *sprite;
+    /* a pixel was turned off, the value left in VF */
+    uint8_t collision;
+} c8_draw_t;
+
+typedef void (*c8_draw_cb)(void *user, const c8_draw_t *draw);
+
 
 /**
  *
@@ -26,10 +99,66 @@ typedef struct c8 c8_t;
 c8_t *c8_create(void);
 
 /**
+ * Free a context and everything attached to it.
+ */
+void c8_destroy(c8_t *ctx);
+
+/**
+ * Execute one instruction. Returns ERR_HALTED without doing anything while
+ * the CPU is halted.
+ */
+int c8_step(c8_t *ctx);
+
+/**
+ * Execute up to budget instructions.
+ *
+ * Returns early after an invalid op (not executed), a jump to itself, a
+ * display change, the sound timer starting or a wait for a key press. The
+ * STOP_* reason is stored in reason unless it is NULL. Returns the number of
+ * instructions executed.
  *
+ * Short loops that go round without changing anything, such as a wait on
+ * the delay timer, are fast-forwarded: the whole rounds left in the budget
+ * are counted as executed and the run ends in the same state.
  *
+ * Returns 0 with STOP_HALTED while the CPU is halted.
  */
-int c8_step(c8_t *ctx);
+int c8_run(c8_t *ctx, unsigned int budget, int *reason);
+
+/**
+ * Whether the CPU is halted, and if so what wakes it up (WAKE_* mask,
+ * stored in wake unless it is NULL):
+ *
+ * - a jump to itself halts for good (WAKE_NONE),
+ * - LD Vx, K without a key pressed waits for c8_set_keys (WAKE_KEY),
+ * - a run that ends in a fast-forwarded idle loop waits for c8_tick_60hz
+ *   or c8_set_keys (WAKE_TIMER | WAKE_KEY).
+ *
+ * c8_set_pc, c8_load and c8_load_file always end a halt.
+ */
+int c8_halted(c8_t *ctx, int *wake);
+
+/**
+ * Seed the random numbers of RND. Machines with the same seed, program and
+ * input run the same; every machine starts with the same default seed.
+ */
+void c8_set_seed(c8_t *ctx, uint64_t seed);
+
+/**
+ * Call cb with every CLS and DRW as it runs, NULL to stop.
+ *
+ * Sprites are XORed into the display and clipped at its right and bottom
+ * edges. draw and the sprite bytes are only valid during the call.
+ */
+void c8_set_draw_callback(c8_t *ctx, c8_draw_cb cb, void *user);
+
+/**
+ * Let c8_run translate straight-line code to native x86-64 code.
+ *
+ * The interpreter remains in use for everything that is not translated, for
+ * c8_step and while tracing. Returns ERR_NOT_SUPPORTED on other hosts.
+ */
+int c8_set_jit(c8_t *ctx, int enable);
 
 /**
  *
@@ -55,6 +184,108 @@ int c8_load_file(c8_t *ctx, const char *filename);
  */
 uint8_t c8_get_pixel(c8_t *ctx, uint8_t x, uint8_t y);
 
+/**
+ * Display generation: changes whenever CLS or DRW change at least one pixel,
+ * and only then. Compare with the value seen last to skip redrawing
+ * unchanged frames.
+ */
+uint32_t c8_display_generation(c8_t *ctx);
+
+/**
+ * Copy the display into rows, one word per line (C8_HEIGHT words). The most
+ * significant bit of a row is x = 0.
+ */
+void c8_get_display(c8_t *ctx, uint64_t *rows);
+
+/**
+ * Expand the display into a C8_WIDTH x C8_HEIGHT image of pitch bytes per
+ * line. Pixels are format bytes wide and set to palette[0] when off,
+ * palette[1] when on, truncated to the pixel size: { 0xFF000000, 0xFFFFFFFF }
+ * with C8_FORMAT_32 gives ARGB8888 black and white.
+ *
+ * Returns ERR_NOT_SUPPORTED for an unknown format.
+ */
+int c8_render_display(c8_t *ctx, void *pixels, int pitch, int format,
+                      const uint32_t palette[2]);
+
+/**
+ * Same as c8_render_display, for the pixels inside rect only (clipped to
+ * the display). pixels is still the top left corner of the whole image, the
+ * rest of it is not written. A NULL rect is the whole display.
+ */
+int c8_render_rect(c8_t *ctx, void *pixels, int pitch, int format,
+                   const uint32_t palette[2], const c8_rect_t *rect);
+
+/**
+ * Hand back what CLS and DRW changed since the last call, and start over.
+ * Pixels that changed and changed back in between do not count.
+ *
+ * Returns 0 if nothing changed. Otherwise returns 1, stores the bounding
+ * box of the changes in rect and a mask of changed lines (bit y for line y)
+ * in rows, each unless it is NULL.
+ */
+int c8_get_dirty(c8_t *ctx, c8_rect_t *rect, uint32_t *rows);
+
+/**
+ * Direct access to the CPU registers, for code generated by c8aot.
+ */
+c8_regs_t *c8_get_regs(c8_t *ctx);
+
+/**
+ * Read-only view of the 4 KB memory. Writes must go through c8_load.
+ */
+const uint8_t *c8_get_mem(c8_t *ctx);
+
+/**
+ * Size in bytes of a saved state, the same for every machine.
+ */
+size_t c8_state_size(void);
+
+/**
+ * Save registers, stack, timers, keys, random number state, memory, display
+ * and halt state into buf, c8_state_size() bytes. The layout is versioned
+ * and little-endian, so a state can be loaded on any host.
+ */
+void c8_save_state(c8_t *ctx, void *buf);
+
+/**
+ * Restore a state saved by c8_save_state. Settings such as tracing, the JIT
+ * and the draw callback are kept. Returns ERR_BAD_STATE, and changes
+ * nothing, if buf does not hold a state of this version.
+ */
+int c8_load_state(c8_t *ctx, const void *buf);
+
+/**
+ * Size in bytes of a machine, for c8_clone_into.
+ */
+size_t c8_size(void);
+
+/**
+ * Make dst a copy of src without allocating: everything c8_save_state
+ * saves, settings such as tracing and the draw callback, and the counters.
+ *
+ * Memory is compared block by block and dst only takes the predecoded
+ * instructions of the blocks that differ, which makes copies of machines
+ * running the same program cheap. dst keeps its own JIT, if enabled, which
+ * starts over when the memory differs.
+ */
+void c8_clone(c8_t *dst, const c8_t *src);
+
+/**
+ * Same as c8_clone, into c8_size() bytes at mem, aligned as by malloc.
+ * Returns mem as a machine without the JIT. It must not be passed to
+ * c8_destroy; disable the JIT with c8_set_jit before reusing mem if it was
+ * enabled on the copy.
+ */
+c8_t *c8_clone_into(void *mem, const c8_t *src);
+
+/**
+ * Counters since c8_create: fused is the number of instruction pairs
+ * c8_run executed with a single dispatch, idle_skipped the number of
+ * instructions of busy-wait loops it counted without executing them.
+ */
+const c8_stats_t *c8_get_stats(c8_t *ctx);
+
 /**
  *
  *
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+
+/*
+ * File layout, little-endian:
+ *
+ *   "C8MV", version (4), seed (8), hash (8), instructions per frame (4),
+ *   reserved (4), then runs of frames with the same keys: frames (4),
+ *   keys (2), until the end of the file.
+ */
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_VERSION 1
+#define HEADER_SIZE 32
+#define RUN_SIZE 6
+
+struct movie
+{
+    FILE *file;
+    int recording;
+    uint64_t seed;
+    uint64_t hash;
+    unsigned int ipf;
+    /* the current run of frames */
+    uint32_t frames;
+    uint16_t keys;
+};
+
+
+static void put_le(uint8_t *dst, uint64_t value, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++)
+        dst[i] = value >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t *src, int size)
+{
+    uint64_t value = 0;
+    int i;
+
+    for (i = size - 1; i >= 0; i--)
+        value = (value << 8) | src[i];
+    return value;
+}
+
+static int flush_run(movie_t *movie)
+{
+    uint8_t run[RUN_SIZE];
+
+    if (!movie->frames)
+        return 0;
+    put_le(&run[0], movie->frames, 4);
+    put_le(&run[4], movie->keys, 2);
+    movie->frames = 0;
+    return fwrite(run, sizeof(run), 1, movie->file) == 1 ? 0 : -1;
+}
+
+/* FNV-1a */
+static uint64_t fnv1a(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+uint64_t movie_hash(c8_t *ctx)
+{
+    return fnv1a(c8_get_mem(ctx), 0x1000);
+}
+
+uint64_t movie_state_hash(c8_t *ctx)
+{
+    uint8_t *state = malloc(c8_state_size());
+    uint64_t hash;
+
+    if (!state)
+        return 0;
+    c8_save_state(ctx, state);
+    hash = fnv1a(state, c8_state_size());
+    free(state);
+    return hash;
+}
+
+movie_t *movie_create(const char *path, uint64_t seed, uint64_t hash,
+                      unsigned int ipf)
+{
+    movie_t *movie = calloc(sizeof(movie_t), 1);
+    uint8_t header[HEADER_SIZE] = {0};
+
+    if (!movie)
+        return NULL;
+    movie->file = fopen(path, "wb");
+    if (!movie->file)
+    {
+        free(movie);
+        return NULL;
+    }
+    movie->recording = 1;
+    movie->seed = seed;
+    movie->hash = hash;
+    movie->ipf = ipf;
+
+    memcpy(header, MOVIE_MAGIC, 4);
+    put_le(&header[4], MOVIE_VERSION, 4);
+    put_le(&header[8], seed, 8);
+    put_le(&header[16], hash, 8);
+    put_le(&header[24], ipf, 4);
+    fwrite(header, sizeof(header), 1, movie->file);
+    return movie;
+}
+
+movie_t *movie_open(const char *path)
+{
+    movie_t *movie = calloc(sizeof(movie_t), 1);
+    uint8_t header[HEADER_SIZE];
+
+    if (!movie)
+        return NULL;
+    movie->file = fopen(path, "rb");
+    if (!movie->file ||
+        (fread(header, sizeof(header), 1, movie->file) != 1) ||
+        memcmp(header, MOVIE_MAGIC, 4) ||
+        (get_le(&header[4], 4) != MOVIE_VERSION))
+    {
+        if (movie->file)
+            fclose(movie->file);
+        free(movie);
+        return NULL;
+    }
+    movie->seed = get_le(&header[8], 8);
+    movie->hash = get_le(&header[16], 8);
+    movie->ipf = get_le(&header[24], 4);
+    return movie;
+}
+
+void movie_info(movie_t *movie, uint64_t *seed, uint64_t *hash,
+                unsigned int *ipf)
+{
+    if (seed)
+        *seed = movie->seed;
+    if (hash)
+        *hash = movie->hash;
+    if (ipf)
+        *ipf = movie->ipf;
+}
+
+void movie_record(movie_t *movie, uint16_t keys)
+{
+    if ((movie->frames && (keys != movie->keys)) ||
+        (movie->frames == UINT32_MAX))
+        (void)flush_run(movie);
+    movie->keys = keys;
+    movie->frames++;
+}
+
+int movie_play(movie_t *movie, uint16_t *keys)
+{
+    uint8_t run[RUN_SIZE];
+
+    while (!movie->frames)
+    {
+        if (fread(run, sizeof(run), 1, movie->file) != 1)
+            return -1;
+        movie->frames = get_le(&run[0], 4);
+        movie->keys = get_le(&run[4], 2);
+    }
+    movie->frames--;
+    *keys = movie->keys;
+    return 0;
+}
+
+int movie_close(movie_t *movie)
+{
+    int ret = 0;
+
+    if (!movie)
+        return 0;
+    if (movie->recording)
+        ret = flush_run(movie);
+    if (fclose(movie->file))
+        ret = -1;
+    free(movie);
+    return ret;
+}
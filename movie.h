@@ -0,0 +1,49 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <c8.h>
+
+/*
+ * A movie is what it takes to run a program again exactly: the seed of its
+ * random numbers, a hash of the memory it started from, the instructions
+ * run per frame and the keys held down in every frame.
+ *
+ * Every frame runs the instructions, then sets the keys, then ticks the
+ * timers.
+ */
+
+typedef struct movie movie_t;
+
+/* hash of the memory of a freshly loaded machine, to match movies to ROMs */
+uint64_t movie_hash(c8_t *ctx);
+
+/* hash of the whole state, equal after two exact replays */
+uint64_t movie_state_hash(c8_t *ctx);
+
+/**
+ * Start recording into the file at path. Returns NULL if it cannot be
+ * written.
+ */
+movie_t *movie_create(const char *path, uint64_t seed, uint64_t hash,
+                      unsigned int ipf);
+
+/**
+ * Open the movie at path for playing. Returns NULL if it cannot be read or
+ * is not a movie.
+ */
+movie_t *movie_open(const char *path);
+
+void movie_info(movie_t *movie, uint64_t *seed, uint64_t *hash,
+                unsigned int *ipf);
+
+/* record the keys of the next frame */
+void movie_record(movie_t *movie, uint16_t keys);
+
+/* play the keys of the next frame, returns -1 after the last frame */
+int movie_play(movie_t *movie, uint16_t *keys);
+
+/* finish writing the movie, if recording, and free it */
+int movie_close(movie_t *movie);
+
+#endif
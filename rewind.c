@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+
+/*
+ * Frames are kept as XOR deltas between consecutive saved states, in a
+ * ring of bytes. The newest state is kept in full: rewinding XORs the
+ * newest delta into it, which gives the state before, and so on back.
+ * Since rewinding only ever walks back from the newest state, the oldest
+ * deltas can be dropped at any time, and no keyframes are needed.
+ *
+ * A delta is a list of runs of changed 64 bit words: a header with the
+ * number of unchanged words to skip and of changed words that follow,
+ * then the XOR of those, ending with an empty run. In the ring every
+ * delta is framed by its size before and after, so that it can be walked
+ * from either end.
+ */
+
+/* size before and after every delta in the ring */
+#define FRAME (2 * sizeof(uint32_t))
+
+typedef struct
+{
+    uint16_t skip;
+    uint16_t len;
+} run_t;
+
+struct rewind_buf
+{
+    uint8_t *ring;
+    size_t capacity;
+    /* oldest delta, end of the newest one, end of the data before 0 */
+    size_t tail;
+    size_t head;
+    size_t wrap;
+    unsigned int count;
+    size_t used;
+    /* the newest state, and room for the next one */
+    uint64_t *cur;
+    uint64_t *next;
+    size_t words;
+    int valid;
+    uint8_t *delta;
+};
+
+
+static size_t encode(const uint64_t *a, const uint64_t *b, size_t words,
+                     uint8_t *out)
+{
+    uint8_t *p = out;
+    run_t run = {0, 0};
+    size_t w = 0;
+
+    while (w < words)
+    {
+        size_t start;
+
+        for (start = w; (w < words) && (a[w] == b[w]); w++)
+            ;
+        if (w == words)
+            break;
+        run.skip = w - start;
+        for (start = w; (w < words) && (a[w] != b[w]); w++)
+            ;
+        run.len = w - start;
+        memcpy(p, &run, sizeof(run));
+        p += sizeof(run);
+        for (; start < w; start++, p += sizeof(uint64_t))
+        {
+            uint64_t x = a[start] ^ b[start];
+
+            memcpy(p, &x, sizeof(x));
+        }
+    }
+    run.skip = 0;
+    run.len = 0;
+    memcpy(p, &run, sizeof(run));
+    return p + sizeof(run) - out;
+}
+
+static void apply(const uint8_t *delta, uint64_t *state)
+{
+    run_t run;
+
+    for (;;)
+    {
+        memcpy(&run, delta, sizeof(run));
+        delta += sizeof(run);
+        if (!run.len)
+            break;
+        for (state += run.skip; run.len; run.len--, state++)
+        {
+            uint64_t x;
+
+            memcpy(&x, delta, sizeof(x));
+            delta += sizeof(x);
+            *state ^= x;
+        }
+    }
+}
+
+static uint32_t size_at(rewind_t *rw, size_t offset)
+{
+    uint32_t size;
+
+    memcpy(&size, rw->ring + offset, sizeof(size));
+    return size;
+}
+
+static void drop_oldest(rewind_t *rw)
+{
+    uint32_t size = size_at(rw, rw->tail);
+
+    rw->tail += size + FRAME;
+    rw->used -= size + FRAME;
+    rw->count--;
+    if (!rw->count)
+        rw->tail = rw->head = rw->wrap = 0;
+    else if (rw->tail == rw->wrap)
+    {
+        rw->tail = 0;
+        rw->wrap = 0;
+    }
+}
+
+/* make room for size bytes at head, dropping the oldest deltas in the way */
+static void make_room(rewind_t *rw, size_t size)
+{
+    if (rw->head + size > rw->capacity)
+    {
+        /* what lies after head is older than what lies before it */
+        while (rw->count && (rw->tail >= rw->head))
+            drop_oldest(rw);
+        if (rw->count)
+        {
+            rw->wrap = rw->head;
+            rw->head = 0;
+        }
+    }
+    while (rw->count && (rw->tail >= rw->head) &&
+           (rw->tail < rw->head + size))
+        drop_oldest(rw);
+}
+
+rewind_t *rewind_create(size_t size)
+{
+    rewind_t *rw = calloc(sizeof(rewind_t), 1);
+
+    if (!rw)
+        return NULL;
+    rw->words = (c8_state_size() + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    rw->capacity = size;
+    rw->ring = malloc(size);
+    rw->cur = calloc(rw->words, sizeof(uint64_t));
+    rw->next = calloc(rw->words, sizeof(uint64_t));
+    /* worst case: every other word changed */
+    rw->delta = malloc(rw->words * (sizeof(uint64_t) + sizeof(run_t)) +
+                       sizeof(run_t));
+    if (!rw->ring || !rw->cur || !rw->next || !rw->delta)
+    {
+        rewind_destroy(rw);
+        return NULL;
+    }
+    return rw;
+}
+
+void rewind_destroy(rewind_t *rw)
+{
+    if (!rw)
+        return;
+    free(rw->ring);
+    free(rw->cur);
+    free(rw->next);
+    free(rw->delta);
+    free(rw);
+}
+
+void rewind_push(rewind_t *rw, c8_t *ctx)
+{
+    uint64_t *swap;
+    uint32_t size;
+
+    c8_save_state(ctx, rw->next);
+    if (rw->valid)
+    {
+        size = encode(rw->next, rw->cur, rw->words, rw->delta);
+        if (size + FRAME <= rw->capacity)
+        {
+            make_room(rw, size + FRAME);
+            memcpy(rw->ring + rw->head, &size, sizeof(size));
+            memcpy(rw->ring + rw->head + sizeof(size), rw->delta, size);
+            memcpy(rw->ring + rw->head + sizeof(size) + size, &size,
+                   sizeof(size));
+            rw->head += size + FRAME;
+            rw->used += size + FRAME;
+            rw->count++;
+        }
+        else
+        {
+            /* too big to keep, and nothing before it can be reached */
+            while (rw->count)
+                drop_oldest(rw);
+        }
+    }
+    rw->valid = 1;
+
+    swap = rw->cur;
+    rw->cur = rw->next;
+    rw->next = swap;
+}
+
+int rewind_pop(rewind_t *rw, c8_t *ctx)
+{
+    uint32_t size;
+
+    if (!rw->count)
+        return -1;
+    if (!rw->head)
+    {
+        rw->head = rw->wrap;
+        rw->wrap = 0;
+    }
+
+    size = size_at(rw, rw->head - sizeof(size));
+    rw->head -= size + FRAME;
+    apply(rw->ring + rw->head + sizeof(size), rw->cur);
+    rw->used -= size + FRAME;
+    rw->count--;
+    if (!rw->count)
+        rw->tail = rw->head = rw->wrap = 0;
+
+    return c8_load_state(ctx, rw->cur) == ERR_OK ? 0 : -1;
+}
+
+void rewind_stats(rewind_t *rw, unsigned int *frames, size_t *bytes)
+{
+    if (frames)
+        *frames = rw->count;
+    if (bytes)
+        *bytes = rw->used;
+}
@@ -0,0 +1,32 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <c8.h>
+
+typedef struct rewind_buf rewind_t;
+
+/**
+ * Create a rewind buffer holding as many frames as fit in size bytes of
+ * deltas. Returns NULL if out of memory.
+ */
+rewind_t *rewind_create(size_t size);
+
+void rewind_destroy(rewind_t *rw);
+
+/**
+ * Record the state of ctx, once per frame. When the buffer is full the
+ * oldest frames are dropped.
+ */
+void rewind_push(rewind_t *rw, c8_t *ctx);
+
+/**
+ * Go back one frame: load the state recorded before the last one into ctx
+ * and forget the last one. Returns -1 when there is nothing left.
+ */
+int rewind_pop(rewind_t *rw, c8_t *ctx);
+
+/* frames that can be rewound, and the bytes they take */
+void rewind_stats(rewind_t *rw, unsigned int *frames, size_t *bytes);
+
+#endif
@@ -0,0 +1,327 @@
+#include <string.h>
+#include "scale.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define WIDTH C8_WIDTH
+#define HEIGHT C8_HEIGHT
+
+/*
+ * The filters work on whole display lines at once: a line is a 64 bit word
+ * with x = 0 in the most significant bit, and the neighbours of every pixel
+ * are the same word shifted by one. Pixels beyond the edges repeat the edge.
+ */
+#define LEFT(row) (((row) >> 1) | ((row) & (1ULL << 63)))
+#define RIGHT(row) (((row) << 1) | ((row) & 1))
+#define SEL(m, a, p) ((p) ^ ((m) & ((a) ^ (p))))
+
+
+/* bit k of v goes to bit 2k of the result */
+static uint64_t spread(uint32_t v)
+{
+    uint64_t x = v;
+
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2)) & 0x3333333333333333ULL;
+    x = (x | (x << 1)) & 0x5555555555555555ULL;
+    return x;
+}
+
+/* bit k of v goes to bit 3k of the result */
+static uint64_t spread3(uint16_t v)
+{
+    uint64_t x = v;
+
+    x = (x | (x << 16)) & 0x00FF0000FF0000FFULL;
+    x = (x | (x << 8)) & 0xF00F00F00F00F00FULL;
+    x = (x | (x << 4)) & 0x30C30C30C30C30C3ULL;
+    x = (x | (x << 2)) & 0x9249249249249249ULL;
+    return x;
+}
+
+/* interleave 2 or 3 lines pixel by pixel into one line as many times wide */
+static void zip(const uint64_t *in, int n, uint64_t *out)
+{
+    uint64_t part[4];
+    int k;
+
+    if (n == 2)
+    {
+        out[0] = (spread(in[0] >> 32) << 1) | spread(in[1] >> 32);
+        out[1] = (spread(in[0]) << 1) | spread(in[1]);
+        return;
+    }
+    /* 16 pixels make 48 bits, 4 of them fill 3 words */
+    for (k = 0; k < 4; k++)
+    {
+        int shift = 48 - 16 * k;
+
+        part[k] = (spread3(in[0] >> shift) << 2) |
+                  (spread3(in[1] >> shift) << 1) | spread3(in[2] >> shift);
+    }
+    out[0] = (part[0] << 16) | (part[1] >> 32);
+    out[1] = (part[1] << 32) | (part[2] >> 16);
+    out[2] = (part[2] << 48) | part[3];
+}
+
+/* turn words * 64 bits into as many pixels */
+#if defined(__AVX2__)
+static void expand(const uint64_t *line, int words, uint32_t *dst,
+                   uint32_t off, uint32_t on)
+{
+    const __m256i sel = _mm256_set_epi32(0x01, 0x02, 0x04, 0x08,
+                                         0x10, 0x20, 0x40, 0x80);
+    const __m256i voff = _mm256_set1_epi32(off);
+    const __m256i diff = _mm256_set1_epi32(on ^ off);
+    int w, b;
+
+    for (w = 0; w < words; w++)
+    {
+        for (b = 0; b < 8; b++, dst += 8)
+        {
+            __m256i bits = _mm256_set1_epi32((line[w] >> (56 - 8 * b)) & 0xFF);
+            __m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(bits, sel), sel);
+            __m256i px = _mm256_xor_si256(voff, _mm256_and_si256(m, diff));
+
+            _mm256_storeu_si256((__m256i *)dst, px);
+        }
+    }
+}
+#elif defined(__SSE2__)
+static void expand(const uint64_t *line, int words, uint32_t *dst,
+                   uint32_t off, uint32_t on)
+{
+    const __m128i hi = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i lo = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+    const __m128i voff = _mm_set1_epi32(off);
+    const __m128i diff = _mm_set1_epi32(on ^ off);
+    int w, b;
+
+    for (w = 0; w < words; w++)
+    {
+        for (b = 0; b < 8; b++, dst += 8)
+        {
+            __m128i bits = _mm_set1_epi32((line[w] >> (56 - 8 * b)) & 0xFF);
+            __m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(bits, hi), hi);
+            __m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(bits, lo), lo);
+
+            _mm_storeu_si128((__m128i *)dst,
+                             _mm_xor_si128(voff, _mm_and_si128(m0, diff)));
+            _mm_storeu_si128((__m128i *)(dst + 4),
+                             _mm_xor_si128(voff, _mm_and_si128(m1, diff)));
+        }
+    }
+}
+#else
+static void expand(const uint64_t *line, int words, uint32_t *dst,
+                   uint32_t off, uint32_t on)
+{
+    int w, x;
+
+    for (w = 0; w < words; w++)
+        for (x = 63; x >= 0; x--)
+            *dst++ = off ^ ((on ^ off) & -(uint32_t)((line[w] >> x) & 1));
+}
+#endif
+
+/* copy the part of a whole output line that lies inside area */
+static void store(const uint32_t *line, uint8_t *dst, int n,
+                  const c8_rect_t *area)
+{
+    memcpy(dst + area->x * n * sizeof(*line), line + area->x * n,
+           area->w * n * sizeof(*line));
+}
+
+/* one output line out of n interleaved filter results */
+static void emit(const uint64_t *in, int n, uint8_t *dst,
+                 const c8_rect_t *area, const uint32_t palette[2])
+{
+    uint64_t line[3];
+    uint32_t px[WIDTH * 3];
+
+    zip(in, n, line);
+    if (area->w == WIDTH)
+        expand(line, n, (uint32_t *)dst, palette[0], palette[1]);
+    else
+    {
+        expand(line, n, px, palette[0], palette[1]);
+        store(px, dst, n, area);
+    }
+}
+
+static void scale_nearest(const uint64_t *rows, uint8_t *dst, int pitch,
+                          int n, const c8_rect_t *area,
+                          const uint32_t palette[2])
+{
+    uint32_t px[WIDTH], buf[WIDTH * SCALE_MAX];
+    size_t skip = area->x * n * sizeof(uint32_t);
+    size_t size = area->w * n * sizeof(uint32_t);
+    int x, y, k, i;
+
+    dst += area->y * n * pitch;
+    for (y = area->y; y < area->y + area->h; y++)
+    {
+        uint32_t *line = (area->w == WIDTH) ? (uint32_t *)dst : buf;
+
+        /*
+         * Small factors widen the bits, larger ones repeat pixels. Either way
+         * the first line is copied down.
+         */
+        if (n == 1)
+            expand(&rows[y], 1, line, palette[0], palette[1]);
+        else if (n <= 3)
+        {
+            uint64_t in[3] = {rows[y], rows[y], rows[y]};
+
+            emit(in, n, dst, area, palette);
+            line = (uint32_t *)dst;
+        }
+        else
+        {
+            expand(&rows[y], 1, px, palette[0], palette[1]);
+            for (x = 0, i = 0; x < WIDTH; x++)
+                for (k = 0; k < n; k++)
+                    line[i++] = px[x];
+        }
+        if (line == buf)
+            store(buf, dst, n, area);
+        for (k = 1; k < n; k++)
+            memcpy(dst + k * pitch + skip, dst + skip, size);
+        dst += n * pitch;
+    }
+}
+
+static void scale_epx(const uint64_t *rows, uint8_t *dst, int pitch,
+                      const c8_rect_t *area, const uint32_t palette[2])
+{
+    int y;
+
+    dst += area->y * 2 * pitch;
+    for (y = area->y; y < area->y + area->h; y++)
+    {
+        uint64_t p = rows[y];
+        uint64_t a = rows[y ? y - 1 : y];
+        uint64_t d = rows[y < HEIGHT - 1 ? y + 1 : y];
+        uint64_t b = RIGHT(p), c = LEFT(p);
+        uint64_t out[2];
+
+        out[0] = SEL(~(c ^ a) & (c ^ d) & (a ^ b), a, p);
+        out[1] = SEL(~(a ^ b) & (a ^ c) & (b ^ d), b, p);
+        emit(out, 2, dst, area, palette);
+        dst += pitch;
+        out[0] = SEL(~(d ^ c) & (d ^ b) & (c ^ a), c, p);
+        out[1] = SEL(~(b ^ d) & (b ^ a) & (d ^ c), d, p);
+        emit(out, 2, dst, area, palette);
+        dst += pitch;
+    }
+}
+
+static void scale_3x(const uint64_t *rows, uint8_t *dst, int pitch,
+                     const c8_rect_t *area, const uint32_t palette[2])
+{
+    int y;
+
+    dst += area->y * 3 * pitch;
+    for (y = area->y; y < area->y + area->h; y++)
+    {
+        /* A B C / D E F / G H I around E */
+        uint64_t e = rows[y];
+        uint64_t b = rows[y ? y - 1 : y];
+        uint64_t h = rows[y < HEIGHT - 1 ? y + 1 : y];
+        uint64_t a = LEFT(b), c = RIGHT(b);
+        uint64_t d = LEFT(e), f = RIGHT(e);
+        uint64_t g = LEFT(h), i = RIGHT(h);
+        uint64_t c1 = ~(d ^ b) & (b ^ f) & (d ^ h);
+        uint64_t c2 = ~(b ^ f) & (b ^ d) & (f ^ h);
+        uint64_t c3 = ~(d ^ h) & (d ^ b) & (h ^ f);
+        uint64_t c4 = ~(h ^ f) & (d ^ h) & (b ^ f);
+        uint64_t out[3];
+
+        out[0] = SEL(c1, d, e);
+        out[1] = SEL((c1 & (e ^ c)) | (c2 & (e ^ a)), b, e);
+        out[2] = SEL(c2, f, e);
+        emit(out, 3, dst, area, palette);
+        dst += pitch;
+        out[0] = SEL((c1 & (e ^ g)) | (c3 & (e ^ a)), d, e);
+        out[1] = e;
+        out[2] = SEL((c2 & (e ^ i)) | (c4 & (e ^ c)), f, e);
+        emit(out, 3, dst, area, palette);
+        dst += pitch;
+        out[0] = SEL(c3, d, e);
+        out[1] = SEL((c3 & (e ^ i)) | (c4 & (e ^ g)), h, e);
+        out[2] = SEL(c4, f, e);
+        emit(out, 3, dst, area, palette);
+        dst += pitch;
+    }
+}
+
+int scale_parse(const char *name, int *filter, int *factor)
+{
+    if (!strcmp(name, "epx") || !strcmp(name, "scale2x"))
+    {
+        *filter = SCALE_EPX;
+        *factor = 2;
+    }
+    else if (!strcmp(name, "scale3x"))
+    {
+        *filter = SCALE_3X;
+        *factor = 3;
+    }
+    else if ((name[0] >= '1') && (name[0] <= '0' + SCALE_MAX) &&
+             !strcmp(&name[1], "x"))
+    {
+        *filter = SCALE_NEAREST;
+        *factor = name[0] - '0';
+    }
+    else
+        return -1;
+    return 0;
+}
+
+int scale_display(const uint64_t *rows, void *pixels, int pitch, int filter,
+                  int factor, const uint32_t palette[2])
+{
+    return scale_rect(rows, pixels, pitch, filter, factor, palette, NULL);
+}
+
+int scale_rect(const uint64_t *rows, void *pixels, int pitch, int filter,
+               int factor, const uint32_t palette[2], const c8_rect_t *rect)
+{
+    c8_rect_t area = {0, 0, WIDTH, HEIGHT};
+
+    if (rect)
+    {
+        int x1 = rect->x + rect->w, y1 = rect->y + rect->h;
+
+        area.x = (rect->x > 0) ? rect->x : 0;
+        area.y = (rect->y > 0) ? rect->y : 0;
+        area.w = ((x1 < WIDTH) ? x1 : WIDTH) - area.x;
+        area.h = ((y1 < HEIGHT) ? y1 : HEIGHT) - area.y;
+    }
+    switch (filter)
+    {
+        case SCALE_NEAREST:
+            if ((factor < 1) || (factor > SCALE_MAX))
+                return -1;
+            if ((area.w > 0) && (area.h > 0))
+                scale_nearest(rows, pixels, pitch, factor, &area, palette);
+            break;
+        case SCALE_EPX:
+            if ((area.w > 0) && (area.h > 0))
+                scale_epx(rows, pixels, pitch, &area, palette);
+            break;
+        case SCALE_3X:
+            if ((area.w > 0) && (area.h > 0))
+                scale_3x(rows, pixels, pitch, &area, palette);
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef SCALE_H
+#define SCALE_H
+
+#include <stdint.h>
+#include <c8.h>
+
+/* largest factor of SCALE_NEAREST */
+#define SCALE_MAX 8
+
+/* filters, see scale_display */
+#define SCALE_NEAREST 0
+#define SCALE_EPX 1
+#define SCALE_3X 2
+
+/**
+ * Look up a filter by name: "1x" to "8x" (nearest neighbour), "epx" or its
+ * other name "scale2x", and "scale3x".
+ *
+ * Returns 0 and stores the filter and its factor, or -1 for an unknown name.
+ */
+int scale_parse(const char *name, int *filter, int *factor);
+
+/**
+ * Upscale a display, as packed by c8_get_display, into 32 bit pixels.
+ *
+ * pixels receives C8_HEIGHT * factor lines of C8_WIDTH * factor pixels,
+ * pitch bytes apart, in palette[0] (off) and palette[1] (on). factor is
+ * ignored for SCALE_EPX (2) and SCALE_3X (3).
+ *
+ * Returns 0, or -1 for an unknown filter or a factor out of range.
+ */
+int scale_display(const uint64_t *rows, void *pixels, int pitch, int filter,
+                  int factor, const uint32_t palette[2]);
+
+/**
+ * Same as scale_display, for the display pixels inside rect only (clipped
+ * to the display), scaled by factor. pixels is still the top left corner of
+ * the whole image, the rest of it is not written. A NULL rect is the whole
+ * display. The filters look at the neighbours of each pixel, so a caller
+ * that changed some pixels must widen rect by one for SCALE_EPX and SCALE_3X.
+ */
+int scale_rect(const uint64_t *rows, void *pixels, int pitch, int filter,
+               int factor, const uint32_t palette[2], const c8_rect_t *rect);
+
+#endif
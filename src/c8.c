@@ -3,16 +3,37 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define C8_JIT
+#include <sys/mman.h>
+#endif
 
 #define MEM_SIZE 0x1000
 #define LOAD_ADDR 0x200
-#define WIDTH 64
-#define HEIGHT 32
+#define RNG_SEED 0x9E3779B97F4A7C15ULL
+#define WIDTH C8_WIDTH
+#define HEIGHT C8_HEIGHT
 #define OPSTRLEN 31
 
 #define BIT(n) (1 << (n))
 #define FLAG_TRACE BIT(0)
 
+/* events raised by the last instructions, see c8_run */
+#define EVENT_DISPLAY BIT(0)
+#define EVENT_SOUND BIT(1)
+#define EVENT_KEY_WAIT BIT(2)
+/* a busy-wait loop went round without changing anything, see idle_check */
+#define EVENT_IDLE BIT(3)
+
+/* longest backward jump that is checked for busy waiting, in bytes */
+#define IDLE_MAX_LOOP 32
+
 
 /*
  * TODO:
@@ -45,17 +66,54 @@ static const uint8_t font_data[16][5] = {
 #define ___N(opcode) ((opcode) & 0xF)
 
 
+typedef struct insn insn_t;
+typedef int (*opfn)(c8_t *ctx, const insn_t *insn);
+
+/* predecoded instruction, cached per memory address (16 bytes) */
+struct insn
+{
+    opfn fn;
+    uint16_t op;
+    uint8_t x;
+    uint8_t y;
+    uint8_t kk;
+    uint8_t id;
+    uint8_t fuse;
+};
+
+/*
+ * Superinstructions: pairs that c8_run executes with a single dispatch. The
+ * first instruction's slot holds the pair, the second one stays predecoded
+ * in its own slot.
+ */
+enum
+{
+    FUSE_NONE,
+    FUSE_SKIP_JP,       /* SE/SNE Vx, byte; JP addr */
+    FUSE_LD_I_DRW,      /* LD I, addr; DRW Vx, Vy, n */
+    FUSE_ADD_SKIP,      /* ADD Vx, byte; SE/SNE Vx, byte */
+};
+
+/* operands printed by an instruction's disassembly format */
+enum
+{
+    ARGS_NONE,
+    ARGS_NNN,
+    ARGS_X,
+    ARGS_X_KK,
+    ARGS_X_Y,
+    ARGS_X_Y_N,
+};
+
+typedef struct {
+    opfn fn;
+    const char *fmt;
+    uint8_t args;
+} op_t;
+
 struct c8
 {
-    struct
-    {
-        uint16_t pc;
-        uint16_t i;
-        uint8_t v[16];
-        uint8_t sp;
-        uint8_t sound_timer;
-        uint8_t delay_timer;
-    } reg;
+    c8_regs_t reg;
     struct
     {
         uint16_t op;
@@ -65,31 +123,125 @@ struct c8
     uint16_t stack[16];
     uint16_t keys;
     uint8_t mem[MEM_SIZE];
-    uint8_t disp[WIDTH][HEIGHT];
+    /* one row per line, the most significant bit is x = 0 */
+    uint64_t disp[HEIGHT];
+    /* bumped whenever a pixel changes */
+    uint32_t generation;
+    /* the display as of the last c8_get_dirty */
+    uint64_t shown[HEIGHT];
+    c8_draw_cb draw;
+    void *draw_user;
+    /* random number generator state, never 0 */
+    uint64_t rng;
     uint8_t flags;
+    uint8_t events;
+    uint8_t halted;
+    uint8_t wake;
+    c8_stats_t stats;
+    /* bumped by everything that changes state outside of reg */
+    uint32_t effects;
+    struct
+    {
+        c8_regs_t reg;
+        uint16_t pc;
+        uint32_t effects;
+        /* instructions per round, 0 until timed */
+        unsigned int period;
+        int measuring;
+        unsigned int start;
+    } idle;
+    /* c8_clone copies everything above in one go */
+    insn_t decoded[MEM_SIZE];
+    struct jit *jit;
+};
+
+/*
+ * Layout of a saved state, see c8_save_state. Every field is little-endian
+ * and they are ordered so that none needs padding: on little-endian hosts
+ * saving and loading are plain copies.
+ */
+struct state
+{
+    uint8_t magic[4];
+    uint32_t version;
+    uint16_t pc;
+    uint16_t i;
+    uint16_t stack[16];
+    uint16_t keys;
+    uint8_t v[16];
+    uint8_t sp;
+    uint8_t sound_timer;
+    uint8_t delay_timer;
+    uint8_t halted;
+    uint8_t wake;
+    uint8_t reserved[5];
+    uint64_t rng;
+    uint64_t disp[HEIGHT];
+    uint8_t mem[MEM_SIZE];
 };
 
+#define STATE_MAGIC "C8ST"
+#define STATE_VERSION 2
+#define STATE_AT(buf, field) ((buf) + offsetof(struct state, field))
+/* memory is compared in blocks of this size on load */
+#define STATE_BLOCK 64
 
-typedef int (*opfn)(c8_t *ctx, uint16_t opcode);
+#ifdef C8_JIT
+static void jit_invalidate(c8_t *ctx, uint32_t first, uint32_t end);
+static void jit_destroy(c8_t *ctx);
+#endif
 
-typedef struct {
-    uint16_t opcode;
-    uint16_t mask;
-    opfn fn;
-} op_t;
 
-#define ARRAY_SIZE(x) ((sizeof x) / (sizeof *x))
+/**
+ * Drop the predecoded instructions overlapping [address, address + size).
+ *
+ * Instructions may start on odd addresses, so the slot right before the
+ * range is dropped as well, and so are the two before that, which may hold
+ * a pair fused with it.
+ */
+static void invalidate(c8_t *ctx, uint32_t address, uint32_t size)
+{
+    uint32_t end = address + size;
+    uint32_t a;
 
+    if (end > MEM_SIZE)
+        end = MEM_SIZE;
+    ctx->effects++;
+    for (a = address > 3 ? address - 3 : 0; a < end; a++)
+    {
+        ctx->decoded[a].fn = NULL;
+        ctx->decoded[a].fuse = FUSE_NONE;
+    }
+#ifdef C8_JIT
+    if (ctx->jit)
+        jit_invalidate(ctx, address, end);
+#endif
+}
 
 /**
  * 00E0 - CLS
  * Clear the display.
  */
-static int op_CLS(c8_t *ctx, uint16_t opcode)
+static int op_CLS(c8_t *ctx, const insn_t *insn)
 {
-    (void)opcode;
-    memset(ctx->disp, 0, WIDTH * HEIGHT);
-    snprintf(ctx->last.opstr, OPSTRLEN, "CLS");
+    uint64_t drawn = 0;
+    int y;
+
+    (void)insn;
+    for (y = 0; y < HEIGHT; y++)
+        drawn |= ctx->disp[y];
+    if (drawn)
+    {
+        memset(ctx->disp, 0, sizeof(ctx->disp));
+        ctx->generation++;
+    }
+    ctx->events |= EVENT_DISPLAY;
+    if (ctx->draw)
+    {
+        c8_draw_t draw = {.type = C8_DRAW_CLS};
+
+        ctx->draw(ctx->draw_user, &draw);
+    }
     return ERR_OK;
 }
 
@@ -100,29 +252,54 @@ static int op_CLS(c8_t *ctx, uint16_t opcode)
  * The interpreter sets the program counter to the address at the top of the
  * stack, then subtracts 1 from the stack pointer.
  */
-static int op_RET(c8_t *ctx, uint16_t opcode)
+static int op_RET(c8_t *ctx, const insn_t *insn)
 {
-    (void)opcode;
+    (void)insn;
     ctx->reg.sp--;
     ctx->reg.pc = ctx->stack[ctx->reg.sp];
-    snprintf(ctx->last.opstr, OPSTRLEN, "RET");
+    ctx->effects++;
     return ERR_OK;
 }
 
+/**
+ * Called on short backward jumps. Raises EVENT_IDLE when the loop ending at
+ * this jump went round once without changing the registers, the timers,
+ * memory or the stack: until the host ticks the timers or changes the
+ * keys, every further round does exactly the same.
+ */
+static void idle_check(c8_t *ctx)
+{
+    if ((ctx->idle.pc == ctx->last.pc) &&
+        (ctx->idle.effects == ctx->effects) &&
+        !memcmp(&ctx->idle.reg, &ctx->reg, sizeof(c8_regs_t)))
+    {
+        ctx->events |= EVENT_IDLE;
+        return;
+    }
+    ctx->idle.pc = ctx->last.pc;
+    ctx->idle.effects = ctx->effects;
+    ctx->idle.reg = ctx->reg;
+    ctx->idle.period = 0;
+}
+
 /**
  * 1nnn - JP addr
  * Jump to location nnn.
  */
-static int op_JP_addr(c8_t *ctx, uint16_t opcode)
+static int op_JP_addr(c8_t *ctx, const insn_t *insn)
 {
-    uint16_t addr = _NNN(opcode);
+    uint16_t addr = _NNN(insn->op);
 
     ctx->reg.pc = addr;
-    snprintf(ctx->last.opstr, OPSTRLEN, "JP\t0x%03X", addr);
     if (ctx->reg.pc == ctx->last.pc)
+    {
+        ctx->halted = 1;
+        ctx->wake = WAKE_NONE;
         return ERR_INFINIT_LOOP;
-    else
-        return ERR_OK;
+    }
+    if ((addr < ctx->last.pc) && (ctx->last.pc - addr <= IDLE_MAX_LOOP))
+        idle_check(ctx);
+    return ERR_OK;
 }
 
 /**
@@ -132,14 +309,14 @@ static int op_JP_addr(c8_t *ctx, uint16_t opcode)
  * The interpreter increments the stack pointer, then puts the current PC on
  * the top of the stack. The PC is then set to nnn.
  */
-static int op_CALL_addr(c8_t *ctx, uint16_t opcode)
+static int op_CALL_addr(c8_t *ctx, const insn_t *insn)
 {
-    uint16_t addr = _NNN(opcode);
+    uint16_t addr = _NNN(insn->op);
 
     ctx->stack[ctx->reg.sp] = ctx->reg.pc;
     ctx->reg.sp++;
     ctx->reg.pc = addr;
-    snprintf(ctx->last.opstr, OPSTRLEN, "CALL\t0x%03X", addr);
+    ctx->effects++;
     return ERR_OK;
 }
 
@@ -147,14 +324,13 @@ static int op_CALL_addr(c8_t *ctx, uint16_t opcode)
  * 3xkk - SE Vx, byte
  * Skip next instruction if Vx = kk.
  */
-static int op_SE_Vx_byte(c8_t *ctx, uint16_t opcode)
+static int op_SE_Vx_byte(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
-    uint8_t byte = __KK(opcode);
+    uint8_t reg = insn->x;
+    uint8_t byte = insn->kk;
 
     if (ctx->reg.v[reg] == byte)
         ctx->reg.pc += 2;
-    snprintf(ctx->last.opstr, OPSTRLEN, "SE\tV%X,\t0x%02X", reg, byte);
     return ERR_OK;
 }
 
@@ -162,14 +338,13 @@ static int op_SE_Vx_byte(c8_t *ctx, uint16_t opcode)
  * 4xkk - SNE Vx, byte
  * Skip next instruction if Vx != kk.
  */
-static int op_SNE_Vx_byte(c8_t *ctx, uint16_t opcode)
+static int op_SNE_Vx_byte(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
-    uint8_t byte = __KK(opcode);
+    uint8_t reg = insn->x;
+    uint8_t byte = insn->kk;
 
     if (ctx->reg.v[reg] != byte)
         ctx->reg.pc += 2;
-    snprintf(ctx->last.opstr, OPSTRLEN, "SNE\tV%X,\t0x%02X", reg, byte);
     return ERR_OK;
 }
 
@@ -177,14 +352,13 @@ static int op_SNE_Vx_byte(c8_t *ctx, uint16_t opcode)
  * 5xy0 - SE Vx, Vy
  * Skip next instruction if Vx = Vy.
  */
-static int op_SE_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_SE_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     if (ctx->reg.v[x] == ctx->reg.v[y])
         ctx->reg.pc += 2;
-    snprintf(ctx->last.opstr, OPSTRLEN, "SE\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -192,13 +366,12 @@ static int op_SE_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 6xkk - LD Vx, byte
  * Set Vx = kk.
  */
-static int op_LD_Vx_byte(c8_t *ctx, uint16_t opcode)
+static int op_LD_Vx_byte(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
-    uint8_t byte = __KK(opcode);
+    uint8_t reg = insn->x;
+    uint8_t byte = insn->kk;
 
     ctx->reg.v[reg] = byte;
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\tV%X,\t0x%02X", reg, byte);
     return ERR_OK;
 }
 
@@ -206,13 +379,12 @@ static int op_LD_Vx_byte(c8_t *ctx, uint16_t opcode)
  * 7xkk - ADD Vx, byte
  * Set Vx = Vx + kk.
  */
-static int op_ADD_Vx_byte(c8_t *ctx, uint16_t opcode)
+static int op_ADD_Vx_byte(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
-    uint8_t byte = __KK(opcode);
+    uint8_t reg = insn->x;
+    uint8_t byte = insn->kk;
 
     ctx->reg.v[reg] += byte;
-    snprintf(ctx->last.opstr, OPSTRLEN, "ADD\tV%X,\t0x%02X", reg, byte);
     return ERR_OK;
 }
 
@@ -220,13 +392,12 @@ static int op_ADD_Vx_byte(c8_t *ctx, uint16_t opcode)
  * 8xy0 - LD Vx, Vy
  * Set Vx = Vy.
  */
-static int op_LD_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_LD_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     ctx->reg.v[x] = ctx->reg.v[y];
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -234,13 +405,12 @@ static int op_LD_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 8xy1 - OR Vx, Vy
 * Set Vx = Vx OR Vy.
 */
-static int op_OR_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_OR_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     ctx->reg.v[x] |= ctx->reg.v[y];
-    snprintf(ctx->last.opstr, OPSTRLEN, "OR\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -249,13 +419,12 @@ static int op_OR_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 8xy2 - AND Vx, Vy
  * Set Vx = Vx AND Vy.
  */
-static int op_AND_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_AND_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     ctx->reg.v[x] &= ctx->reg.v[y];
-    snprintf(ctx->last.opstr, OPSTRLEN, "AND\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -263,13 +432,12 @@ static int op_AND_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 8xy3 - XOR Vx, Vy
  * Set Vx = Vx XOR Vy.
  */
-static int op_XOR_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_XOR_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     ctx->reg.v[x] ^= ctx->reg.v[y];
-    snprintf(ctx->last.opstr, OPSTRLEN, "XOR\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -277,14 +445,13 @@ static int op_XOR_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 8xy4 - ADD Vx, Vy
  * Set Vx = Vx + Vy, set VF = carry.
  */
-static int op_ADD_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_ADD_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     ctx->reg.v[0xF] = (uint16_t)ctx->reg.v[x] + (uint16_t)ctx->reg.v[y] > 0xFF;
     ctx->reg.v[x] += ctx->reg.v[y];
-    snprintf(ctx->last.opstr, OPSTRLEN, "ADD\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
  
@@ -292,14 +459,13 @@ static int op_ADD_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 8xy5 - SUB Vx, Vy
  * Set Vx = Vx - Vy, set VF = NOT borrow.
  */
-static int op_SUB_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_SUB_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     ctx->reg.v[0xF] = ctx->reg.v[x] > ctx->reg.v[y];
     ctx->reg.v[x] -= ctx->reg.v[y];
-    snprintf(ctx->last.opstr, OPSTRLEN, "SUB\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -307,14 +473,13 @@ static int op_SUB_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 8xy6 - SHR Vx, Vy
  * Set Vx = Vy SHR 1.
  */
-static int op_SHR_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_SHR_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     ctx->reg.v[0xF] = ctx->reg.v[y] & 0x1;
     ctx->reg.v[x] = ctx->reg.v[y] >> 1;
-    snprintf(ctx->last.opstr, OPSTRLEN, "SHR\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -322,14 +487,13 @@ static int op_SHR_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 8xy7 - SUBN Vx, Vy
  * Set Vx = Vy - Vx, set VF = NOT borrow.
  */
-static int op_SUBN_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_SUBN_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     ctx->reg.v[0xF] = ctx->reg.v[y] > ctx->reg.v[x];
     ctx->reg.v[x] = ctx->reg.v[y] - ctx->reg.v[x];
-    snprintf(ctx->last.opstr, OPSTRLEN, "SUBN\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -337,14 +501,13 @@ static int op_SUBN_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 8xyE - SHL Vx , Vy
  * Set Vx = Vy SHL 1.
  */
-static int op_SHL_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_SHL_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     ctx->reg.v[0xF] = ctx->reg.v[y] & 0x80 ? 1 : 0;
     ctx->reg.v[x] = ctx->reg.v[y] << 1;
-    snprintf(ctx->last.opstr, OPSTRLEN, "SHL\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -352,14 +515,13 @@ static int op_SHL_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * 9xy0 - SNE Vx, Vy
  * Skip next instruction if Vx != Vy.
  */
-static int op_SNE_Vx_Vy(c8_t *ctx, uint16_t opcode)
+static int op_SNE_Vx_Vy(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
 
     if (ctx->reg.v[x] != ctx->reg.v[y])
         ctx->reg.pc += 2;
-    snprintf(ctx->last.opstr, OPSTRLEN, "SNE\tV%X,\tV%X", x, y);
     return ERR_OK;
 }
 
@@ -367,12 +529,11 @@ static int op_SNE_Vx_Vy(c8_t *ctx, uint16_t opcode)
  * Annn - LD I, addr
  * Set I = nnn.
  */
-static int op_LD_I_addr(c8_t *ctx, uint16_t opcode)
+static int op_LD_I_addr(c8_t *ctx, const insn_t *insn)
 {
-    uint16_t addr = _NNN(opcode);
+    uint16_t addr = _NNN(insn->op);
 
     ctx->reg.i = addr;
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\tI,\t0x%03X", addr);
     return ERR_OK;
 }
 
@@ -380,26 +541,37 @@ static int op_LD_I_addr(c8_t *ctx, uint16_t opcode)
  * Bnnn - JP V0, addr
  * Jump to location nnn + V0.
  */
-static int op_JP_V0_addr(c8_t *ctx, uint16_t opcode)
+static int op_JP_V0_addr(c8_t *ctx, const insn_t *insn)
 {
-    uint16_t addr = _NNN(opcode);
+    uint16_t addr = _NNN(insn->op);
 
     ctx->reg.pc = ctx->reg.v[0] + addr;
-    snprintf(ctx->last.opstr, OPSTRLEN, "JP\tV0,\t0x%03X", addr);
     return ERR_OK;
 }
 
+/* xorshift64*, the top byte is the best mixed */
+static uint8_t rng_next(c8_t *ctx)
+{
+    uint64_t x = ctx->rng;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    ctx->rng = x;
+    return (x * 0x2545F4914F6CDD1DULL) >> 56;
+}
+
 /**
  * Cxkk - RND Vx, byte
  * Set Vx = random byte AND kk.
  */
-static int op_RND_Vx_byte(c8_t *ctx, uint16_t opcode)
+static int op_RND_Vx_byte(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
-    uint8_t byte = __KK(opcode);
+    uint8_t reg = insn->x;
+    uint8_t byte = insn->kk;
 
-    ctx->reg.v[reg] = rand() & byte;
-    snprintf(ctx->last.opstr, OPSTRLEN, "RND\tV%x,\t0x%X", reg, byte);
+    ctx->reg.v[reg] = rng_next(ctx) & byte;
+    ctx->effects++;
     return ERR_OK;
 }
 
@@ -407,178 +579,417 @@ static int op_RND_Vx_byte(c8_t *ctx, uint16_t opcode)
  * Dxyn - DRW Vx, Vy, nibble
  * Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
  */
-static int op_DRW_Vx_Vy_n(c8_t *ctx, uint16_t opcode)
+static int op_DRW_Vx_Vy_n(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t x = _X__(opcode);
-    uint8_t y = __Y_(opcode);
-    uint8_t n = ___N(opcode);
+    uint8_t x = insn->x;
+    uint8_t y = insn->y;
+    uint8_t n = ___N(insn->kk);
 
     uint8_t xcord = ctx->reg.v[x] & (WIDTH-1);
     uint8_t ycord = ctx->reg.v[y] & (HEIGHT-1);
-    uint8_t _x, _y;
+    /* sprites are clipped at the right and bottom edges */
+    uint8_t rows = n < HEIGHT - ycord ? n : HEIGHT - ycord;
+    const uint8_t *sprite = &ctx->mem[ctx->reg.i];
+    uint64_t *line = &ctx->disp[ycord];
+    uint64_t collision = 0;
+    uint64_t drawn = 0;
+    uint8_t _y;
+
+    ctx->events |= EVENT_DISPLAY;
+    /* every sprite line is one shift and one XOR into its display line */
+    for (_y = 0; _y < rows; _y++)
+    {
+        uint64_t bits = ((uint64_t)sprite[_y] << (WIDTH - 8)) >> xcord;
 
-    ctx->reg.v[0xF] = 0;
-    for (_y=0; _y<n; _y++) {
-        uint8_t data = ctx->mem[_y + ctx->reg.i];
+        collision |= line[_y] & bits;
+        drawn |= bits;
+        line[_y] ^= bits;
+    }
+    ctx->reg.v[0xF] = collision != 0;
+    if (drawn)
+        ctx->generation++;
+    if (ctx->draw)
+    {
+        c8_draw_t draw = {.type = C8_DRAW_SPRITE, .x = xcord, .y = ycord,
+                          .n = n, .sprite = sprite,
+                          .collision = ctx->reg.v[0xF]};
 
-        for (_x = 0; _x < 8; _x++)
-        {
-            uint8_t value = (data >> (7 - _x)) & 1;
-            ctx->disp[_x + xcord][_y + ycord] ^= value;
-            if (value && !ctx->disp[_x + xcord][_y + ycord])
-                ctx->reg.v[0xF] = 1;
-        }
+        ctx->draw(ctx->draw_user, &draw);
     }
 
-    snprintf(ctx->last.opstr, OPSTRLEN, "DRW\tV%x,\tV%X,\t0x%X", x, y, n);
     return ERR_OK;
 }
 
-static int op_SKNP_Vx(c8_t *ctx, uint16_t opcode)
+static int op_SKNP_Vx(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
 
     if (ctx->reg.v[reg] < 16)
         if (!(ctx->keys & BIT(ctx->reg.v[reg])))
             ctx->reg.pc += 2;
 
-    snprintf(ctx->last.opstr, OPSTRLEN, "SKNP\tV%X", reg);
     return ERR_OK;
 }
 
-static int op_SKP_Vx(c8_t *ctx, uint16_t opcode)
+static int op_SKP_Vx(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
 
     if (ctx->reg.v[reg] < 16)
         if (ctx->keys & BIT(ctx->reg.v[reg]))
             ctx->reg.pc += 2;
 
-    snprintf(ctx->last.opstr, OPSTRLEN, "SKP\tV%X", reg);
     return ERR_OK;
 }
 
-static int op_LD_Vx_DT(c8_t *ctx, uint16_t opcode)
+static int op_LD_Vx_DT(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
 
     ctx->reg.v[reg] = ctx->reg.delay_timer;
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\tV%X,\tDT", reg);
     return ERR_OK;
 }
 
-// case 0x0A:
-// {
-/* LD Vx, K */
-/* TODO: */
-// break;
-// }
+/**
+ * Fx0A - LD Vx, K
+ * Wait for a key press, store the value of the key in Vx.
+ *
+ * While no key is pressed the CPU halts until c8_set_keys, then executes
+ * the instruction again.
+ */
+static int op_LD_Vx_K(c8_t *ctx, const insn_t *insn)
+{
+    uint8_t reg = insn->x;
+
+    if (!ctx->keys)
+    {
+        ctx->reg.pc -= 2;
+        ctx->events |= EVENT_KEY_WAIT;
+        ctx->halted = 1;
+        ctx->wake = WAKE_KEY;
+        return ERR_OK;
+    }
+
+    ctx->reg.v[reg] = __builtin_ctz(ctx->keys);
+    return ERR_OK;
+}
 
-static int op_LD_DT_Vx(c8_t *ctx, uint16_t opcode)
+static int op_LD_DT_Vx(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
 
     ctx->reg.delay_timer = ctx->reg.v[reg];
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\tDT,\tV%X", reg);
     return ERR_OK;
 }
 
-static int op_LD_ST_Vx(c8_t *ctx, uint16_t opcode)
+static int op_LD_ST_Vx(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
 
+    if (!ctx->reg.sound_timer && ctx->reg.v[reg])
+        ctx->events |= EVENT_SOUND;
     ctx->reg.sound_timer = ctx->reg.v[reg];
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\tST,\tV%X", reg);
     return ERR_OK;
 }
 
-static int op_ADD_I_Vx(c8_t *ctx, uint16_t opcode)
+static int op_ADD_I_Vx(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
 
     ctx->reg.v[0xF] =
             ((uint32_t)ctx->reg.i + (uint32_t)ctx->reg.v[reg]) > 0xFFF;
     ctx->reg.i = ctx->reg.i + ctx->reg.v[reg];
-    snprintf(ctx->last.opstr, OPSTRLEN, "ADD\tI,\tV%X", reg);
     return ERR_OK;
 }
 
-static int op_LD_I_FONT_Vx(c8_t *ctx, uint16_t opcode)
+static int op_LD_I_FONT_Vx(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
 
     ctx->reg.i = ctx->reg.v[reg] * 5;
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\tI,\tFONT(V%X)", reg);
     return ERR_OK;
 }
 
-static int op_LD_B_Vx(c8_t *ctx, uint16_t opcode)
+static int op_LD_B_Vx(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
 
+    invalidate(ctx, ctx->reg.i, 3);
     ctx->mem[ctx->reg.i + 0] = (ctx->reg.v[reg] / 100) % 10;
     ctx->mem[ctx->reg.i + 1] = (ctx->reg.v[reg] / 10) % 10;
     ctx->mem[ctx->reg.i + 2] = ctx->reg.v[reg] % 10;
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\tB,\tV%X", reg);
     return ERR_OK;
 }
 
-static int op_LD_addrI_Vx(c8_t *ctx, uint16_t opcode)
+static int op_LD_addrI_Vx(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
     uint8_t i;
 
+    invalidate(ctx, ctx->reg.i, reg + 1);
     for (i = 0; i <= reg; i++)
         ctx->mem[ctx->reg.i++] = ctx->reg.v[i];
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\t[I],\tV%X", reg);
     return ERR_OK;
 }
 
-static int op_LD_Vx_addrI(c8_t *ctx, uint16_t opcode)
+static int op_LD_Vx_addrI(c8_t *ctx, const insn_t *insn)
 {
-    uint8_t reg = _X__(opcode);
+    uint8_t reg = insn->x;
     uint8_t i;
 
     for (i = 0; i <= reg; i++)
         ctx->reg.v[i] = ctx->mem[ctx->reg.i++];
-    snprintf(ctx->last.opstr, OPSTRLEN, "LD\tV%X,\t[I]", reg);
-    return ERR_OK;
-}
-
-op_t ops[] = {{0x00E0, 0xFFFF, op_CLS},
-              {0x00EE, 0xFFFF, op_RET},
-              {0x1000, 0xF000, op_JP_addr},
-              {0x2000, 0xF000, op_CALL_addr},
-              {0x3000, 0xF000, op_SE_Vx_byte},
-              {0x4000, 0xF000, op_SNE_Vx_byte},
-              {0x5000, 0xF00F, op_SE_Vx_Vy},
-              {0x6000, 0xF000, op_LD_Vx_byte},
-              {0x7000, 0xF000, op_ADD_Vx_byte},
-              {0x8000, 0xF00F, op_LD_Vx_Vy},
-              {0x8001, 0xF00F, op_OR_Vx_Vy},
-              {0x8002, 0xF00F, op_AND_Vx_Vy},
-              {0x8003, 0xF00F, op_XOR_Vx_Vy},
-              {0x8004, 0xF00F, op_ADD_Vx_Vy},
-              {0x8005, 0xF00F, op_SUB_Vx_Vy},
-              {0x8006, 0xF00F, op_SHR_Vx_Vy},
-              {0x8007, 0xF00F, op_SUBN_Vx_Vy},
-              {0x800E, 0xF00F, op_SHL_Vx_Vy},
-              {0x9000, 0xF00F, op_SNE_Vx_Vy},
-              {0xA000, 0xF000, op_LD_I_addr},
-              {0xB000, 0xF000, op_JP_V0_addr},
-              {0xC000, 0xF000, op_RND_Vx_byte},
-              {0xD000, 0xF000, op_DRW_Vx_Vy_n},
-              {0xE09E, 0xF0FF, op_SKP_Vx},
-              {0xE0A1, 0xF0FF, op_SKNP_Vx},
-              {0xF007, 0xF0FF, op_LD_Vx_DT},
-              //  { 0xF00A, 0xF0FF, op_LD_Vx_K},
-              {0xF015, 0xF0FF, op_LD_DT_Vx},
-              {0xF018, 0xF0FF, op_LD_ST_Vx},
-              {0xF01E, 0xF0FF, op_ADD_I_Vx},
-              {0xF029, 0xF0FF, op_LD_I_FONT_Vx},
-              {0xF033, 0xF0FF, op_LD_B_Vx},
-              {0xF055, 0xF0FF, op_LD_addrI_Vx},
-              {0xF065, 0xF0FF, op_LD_Vx_addrI}};
+    return ERR_OK;
+}
+
+static int op_invalid(c8_t *ctx, const insn_t *insn)
+{
+    (void)ctx;
+    (void)insn;
+    return ERR_INVALID_OP;
+}
+
+/* instruction set, with the disassembly format of each instruction */
+enum
+{
+    OP_INVALID,
+    OP_CLS,
+    OP_RET,
+    OP_JP_addr,
+    OP_CALL_addr,
+    OP_SE_Vx_byte,
+    OP_SNE_Vx_byte,
+    OP_SE_Vx_Vy,
+    OP_LD_Vx_byte,
+    OP_ADD_Vx_byte,
+    OP_LD_Vx_Vy,
+    OP_OR_Vx_Vy,
+    OP_AND_Vx_Vy,
+    OP_XOR_Vx_Vy,
+    OP_ADD_Vx_Vy,
+    OP_SUB_Vx_Vy,
+    OP_SHR_Vx_Vy,
+    OP_SUBN_Vx_Vy,
+    OP_SHL_Vx_Vy,
+    OP_SNE_Vx_Vy,
+    OP_LD_I_addr,
+    OP_JP_V0_addr,
+    OP_RND_Vx_byte,
+    OP_DRW_Vx_Vy_n,
+    OP_SKNP_Vx,
+    OP_SKP_Vx,
+    OP_LD_Vx_DT,
+    OP_LD_Vx_K,
+    OP_LD_DT_Vx,
+    OP_LD_ST_Vx,
+    OP_ADD_I_Vx,
+    OP_LD_I_FONT_Vx,
+    OP_LD_B_Vx,
+    OP_LD_addrI_Vx,
+    OP_LD_Vx_addrI,
+    OP_COUNT
+};
+
+static const op_t ops[OP_COUNT] = {
+        [OP_INVALID] = {op_invalid, "", ARGS_NONE},
+        [OP_CLS] = {op_CLS, "CLS", ARGS_NONE},
+        [OP_RET] = {op_RET, "RET", ARGS_NONE},
+        [OP_JP_addr] = {op_JP_addr, "JP\t0x%03X", ARGS_NNN},
+        [OP_CALL_addr] = {op_CALL_addr, "CALL\t0x%03X", ARGS_NNN},
+        [OP_SE_Vx_byte] = {op_SE_Vx_byte, "SE\tV%X,\t0x%02X", ARGS_X_KK},
+        [OP_SNE_Vx_byte] = {op_SNE_Vx_byte, "SNE\tV%X,\t0x%02X", ARGS_X_KK},
+        [OP_SE_Vx_Vy] = {op_SE_Vx_Vy, "SE\tV%X,\tV%X", ARGS_X_Y},
+        [OP_LD_Vx_byte] = {op_LD_Vx_byte, "LD\tV%X,\t0x%02X", ARGS_X_KK},
+        [OP_ADD_Vx_byte] = {op_ADD_Vx_byte, "ADD\tV%X,\t0x%02X", ARGS_X_KK},
+        [OP_LD_Vx_Vy] = {op_LD_Vx_Vy, "LD\tV%X,\tV%X", ARGS_X_Y},
+        [OP_OR_Vx_Vy] = {op_OR_Vx_Vy, "OR\tV%X,\tV%X", ARGS_X_Y},
+        [OP_AND_Vx_Vy] = {op_AND_Vx_Vy, "AND\tV%X,\tV%X", ARGS_X_Y},
+        [OP_XOR_Vx_Vy] = {op_XOR_Vx_Vy, "XOR\tV%X,\tV%X", ARGS_X_Y},
+        [OP_ADD_Vx_Vy] = {op_ADD_Vx_Vy, "ADD\tV%X,\tV%X", ARGS_X_Y},
+        [OP_SUB_Vx_Vy] = {op_SUB_Vx_Vy, "SUB\tV%X,\tV%X", ARGS_X_Y},
+        [OP_SHR_Vx_Vy] = {op_SHR_Vx_Vy, "SHR\tV%X,\tV%X", ARGS_X_Y},
+        [OP_SUBN_Vx_Vy] = {op_SUBN_Vx_Vy, "SUBN\tV%X,\tV%X", ARGS_X_Y},
+        [OP_SHL_Vx_Vy] = {op_SHL_Vx_Vy, "SHL\tV%X,\tV%X", ARGS_X_Y},
+        [OP_SNE_Vx_Vy] = {op_SNE_Vx_Vy, "SNE\tV%X,\tV%X", ARGS_X_Y},
+        [OP_LD_I_addr] = {op_LD_I_addr, "LD\tI,\t0x%03X", ARGS_NNN},
+        [OP_JP_V0_addr] = {op_JP_V0_addr, "JP\tV0,\t0x%03X", ARGS_NNN},
+        [OP_RND_Vx_byte] = {op_RND_Vx_byte, "RND\tV%x,\t0x%X", ARGS_X_KK},
+        [OP_DRW_Vx_Vy_n] = {op_DRW_Vx_Vy_n, "DRW\tV%x,\tV%X,\t0x%X", ARGS_X_Y_N},
+        [OP_SKNP_Vx] = {op_SKNP_Vx, "SKNP\tV%X", ARGS_X},
+        [OP_SKP_Vx] = {op_SKP_Vx, "SKP\tV%X", ARGS_X},
+        [OP_LD_Vx_DT] = {op_LD_Vx_DT, "LD\tV%X,\tDT", ARGS_X},
+        [OP_LD_Vx_K] = {op_LD_Vx_K, "LD\tV%X,\tK", ARGS_X},
+        [OP_LD_DT_Vx] = {op_LD_DT_Vx, "LD\tDT,\tV%X", ARGS_X},
+        [OP_LD_ST_Vx] = {op_LD_ST_Vx, "LD\tST,\tV%X", ARGS_X},
+        [OP_ADD_I_Vx] = {op_ADD_I_Vx, "ADD\tI,\tV%X", ARGS_X},
+        [OP_LD_I_FONT_Vx] = {op_LD_I_FONT_Vx, "LD\tI,\tFONT(V%X)", ARGS_X},
+        [OP_LD_B_Vx] = {op_LD_B_Vx, "LD\tB,\tV%X", ARGS_X},
+        [OP_LD_addrI_Vx] = {op_LD_addrI_Vx, "LD\t[I],\tV%X", ARGS_X},
+        [OP_LD_Vx_addrI] = {op_LD_Vx_addrI, "LD\tV%X,\t[I]", ARGS_X},
+};
+
+/*
+ * Decode tables. The top nibble selects the instruction group; groups that
+ * hold more than one instruction are indexed by their sub-opcode field, so
+ * every opcode is resolved with at most two table lookups.
+ */
+static const uint8_t ops_nnnn[16] = {
+        [0x1] = OP_JP_addr,
+        [0x2] = OP_CALL_addr,
+        [0x3] = OP_SE_Vx_byte,
+        [0x4] = OP_SNE_Vx_byte,
+        [0x5] = OP_SE_Vx_Vy,
+        [0x6] = OP_LD_Vx_byte,
+        [0x7] = OP_ADD_Vx_byte,
+        [0x9] = OP_SNE_Vx_Vy,
+        [0xA] = OP_LD_I_addr,
+        [0xB] = OP_JP_V0_addr,
+        [0xC] = OP_RND_Vx_byte,
+        [0xD] = OP_DRW_Vx_Vy_n,
+};
+
+static const uint8_t ops_8xyN[16] = {
+        [0x0] = OP_LD_Vx_Vy,
+        [0x1] = OP_OR_Vx_Vy,
+        [0x2] = OP_AND_Vx_Vy,
+        [0x3] = OP_XOR_Vx_Vy,
+        [0x4] = OP_ADD_Vx_Vy,
+        [0x5] = OP_SUB_Vx_Vy,
+        [0x6] = OP_SHR_Vx_Vy,
+        [0x7] = OP_SUBN_Vx_Vy,
+        [0xE] = OP_SHL_Vx_Vy,
+};
+
+static const uint8_t ops_ExKK[256] = {
+        [0x9E] = OP_SKP_Vx,
+        [0xA1] = OP_SKNP_Vx,
+};
+
+static const uint8_t ops_FxKK[256] = {
+        [0x07] = OP_LD_Vx_DT,
+        [0x0A] = OP_LD_Vx_K,
+        [0x15] = OP_LD_DT_Vx,
+        [0x18] = OP_LD_ST_Vx,
+        [0x1E] = OP_ADD_I_Vx,
+        [0x29] = OP_LD_I_FONT_Vx,
+        [0x33] = OP_LD_B_Vx,
+        [0x55] = OP_LD_addrI_Vx,
+        [0x65] = OP_LD_Vx_addrI,
+};
+
+/**
+ * Look up the instruction for an opcode, OP_INVALID if the opcode is invalid.
+ */
+static uint8_t decode(uint16_t opcode)
+{
+    switch (opcode >> 12)
+    {
+        case 0x0:
+            if (opcode == 0x00E0)
+                return OP_CLS;
+            if (opcode == 0x00EE)
+                return OP_RET;
+            return OP_INVALID;
+        case 0x5:
+        case 0x9:
+            if (___N(opcode) != 0)
+                return OP_INVALID;
+            return ops_nnnn[opcode >> 12];
+        case 0x8:
+            return ops_8xyN[___N(opcode)];
+        case 0xE:
+            return ops_ExKK[__KK(opcode)];
+        case 0xF:
+            return ops_FxKK[__KK(opcode)];
+        default:
+            return ops_nnnn[opcode >> 12];
+    }
+}
+
+
+/**
+ * Pick the superinstruction for insn followed by next, FUSE_NONE if none.
+ */
+static uint8_t fuse(const insn_t *insn, uint16_t next)
+{
+    uint8_t id = decode(next);
+
+    switch (insn->id)
+    {
+        case OP_SE_Vx_byte:
+        case OP_SNE_Vx_byte:
+            if (id == OP_JP_addr)
+                return FUSE_SKIP_JP;
+            break;
+        case OP_LD_I_addr:
+            if (id == OP_DRW_Vx_Vy_n)
+                return FUSE_LD_I_DRW;
+            break;
+        case OP_ADD_Vx_byte:
+            if (((id == OP_SE_Vx_byte) || (id == OP_SNE_Vx_byte)) &&
+                (_X__(next) == insn->x))
+                return FUSE_ADD_SKIP;
+            break;
+    }
+    return FUSE_NONE;
+}
+
+/**
+ * Fill the predecode slot for the instruction at address.
+ */
+static const insn_t *predecode(c8_t *ctx, uint16_t address)
+{
+    insn_t *insn = &ctx->decoded[address];
+    uint16_t opcode = (ctx->mem[address] << 8) | ctx->mem[address + 1];
+
+    insn->op = opcode;
+    insn->x = _X__(opcode);
+    insn->y = __Y_(opcode);
+    insn->kk = __KK(opcode);
+    insn->id = decode(opcode);
+    insn->fuse = FUSE_NONE;
+    if (address + 2 <= MEM_SIZE - 2)
+    {
+        insn->fuse = fuse(insn, (ctx->mem[address + 2] << 8) |
+                                ctx->mem[address + 3]);
+        /* the pair is executed from both slots */
+        if (insn->fuse && !ctx->decoded[address + 2].fn)
+            predecode(ctx, address + 2);
+    }
+    insn->fn = ops[insn->id].fn;
+    return insn;
+}
+
+/**
+ * Disassemble opcode into buf, an empty string for invalid opcodes.
+ */
+static void disasm(uint16_t opcode, char *buf, size_t size)
+{
+    const op_t *op = &ops[decode(opcode)];
+
+    switch (op->args)
+    {
+        case ARGS_NNN:
+            snprintf(buf, size, op->fmt, _NNN(opcode));
+            break;
+        case ARGS_X:
+            snprintf(buf, size, op->fmt, _X__(opcode));
+            break;
+        case ARGS_X_KK:
+            snprintf(buf, size, op->fmt, _X__(opcode), __KK(opcode));
+            break;
+        case ARGS_X_Y:
+            snprintf(buf, size, op->fmt, _X__(opcode), __Y_(opcode));
+            break;
+        case ARGS_X_Y_N:
+            snprintf(buf, size, op->fmt, _X__(opcode), __Y_(opcode),
+                     ___N(opcode));
+            break;
+        default:
+            snprintf(buf, size, "%s", op->fmt);
+            break;
+    }
+}
 
 
 c8_t *c8_create(void)
@@ -587,32 +998,66 @@ c8_t *c8_create(void)
     if (!ctx)
         return NULL;
     memcpy(&ctx->mem[0], font_data, sizeof(font_data));
+    ctx->rng = RNG_SEED;
     return ctx;
 }
 
-int c8_step(c8_t *ctx)
+void c8_set_seed(c8_t *ctx, uint64_t seed)
 {
-    int ret = ERR_INVALID_OP;
-    unsigned int i;
+    /* xorshift gets stuck on 0 */
+    ctx->rng = seed ? seed : RNG_SEED;
+}
 
-    /* fetch, decode and execute OP code */
-    ctx->last.pc = ctx->reg.pc;
-    ctx->last.op = (ctx->mem[ctx->reg.pc] << 8) | (ctx->mem[ctx->reg.pc + 1]);
-    ctx->last.opstr[0] = '\0';
-    ctx->reg.pc += 2;
+void c8_set_draw_callback(c8_t *ctx, c8_draw_cb cb, void *user)
+{
+    ctx->draw = cb;
+    ctx->draw_user = user;
+}
+
+void c8_destroy(c8_t *ctx)
+{
+    if (!ctx)
+        return;
+#ifdef C8_JIT
+    jit_destroy(ctx);
+#endif
+    free(ctx);
+}
+
+static void trace(c8_t *ctx)
+{
+    disasm(ctx->last.op, ctx->last.opstr, OPSTRLEN);
+    fprintf(stderr, "%03x:\t%04x\t;\t%s\n", ctx->last.pc, ctx->last.op,
+            ctx->last.opstr);
+}
+
+/**
+ * Fetch, decode and execute one instruction.
+ */
+static inline int execute(c8_t *ctx)
+{
+    const insn_t *insn;
+    int ret;
 
-    for (i = 0; i < ARRAY_SIZE(ops); i++)
+    ctx->last.pc = ctx->reg.pc;
+    if (ctx->reg.pc > MEM_SIZE - 2)
     {
-        if ((ctx->last.op & ops[i].mask) == ops[i].opcode)
-        {
-            ret = ops[i].fn(ctx, ctx->last.op);
-            break;
-        }
+        ctx->last.op = 0;
+        return ERR_INVALID_OP;
     }
 
+    /* fetch and decode, unless the slot is already predecoded */
+    insn = &ctx->decoded[ctx->reg.pc];
+    if (!insn->fn)
+        insn = predecode(ctx, ctx->reg.pc);
+
+    /* execute OP code */
+    ctx->last.op = insn->op;
+    ctx->reg.pc += 2;
+    ret = insn->fn(ctx, insn);
+
     if (ctx->flags & FLAG_TRACE)
-        fprintf(stderr, "%03x:\t%04x\t;\t%s\n", ctx->last.pc, ctx->last.op,
-                ctx->last.opstr);
+        trace(ctx);
 
     /* restore pc if needed */
     if (ret == ERR_INVALID_OP)
@@ -621,59 +1066,1230 @@ int c8_step(c8_t *ctx)
     return ret;
 }
 
-int c8_tick_60hz(c8_t *ctx)
+/**
+ * Execute the superinstruction at pc, adding the number of instructions
+ * executed to n. last.pc and last.op always describe the instruction that
+ * ran last, so errors in the second half are reported precisely.
+ */
+static inline int execute_fused(c8_t *ctx, const insn_t *insn,
+                                unsigned int *n)
 {
-    int ret = ERR_OK;
-
-    if (ctx->reg.delay_timer > 0)
-        ctx->reg.delay_timer--;
-    if (ctx->reg.sound_timer > 0)
-        ctx->reg.sound_timer--;
-    if (ctx->reg.sound_timer > 0)
-        ret = ERR_SOUND_ON;
+    const insn_t *next = insn + 2;
+    int ret;
 
+    ctx->last.pc = ctx->reg.pc;
+    ctx->last.op = insn->op;
+    ctx->stats.fused++;
+    (*n)++;
+    switch (insn->fuse)
+    {
+        case FUSE_SKIP_JP:
+            /* a taken skip steps over the JP */
+            if ((ctx->reg.v[insn->x] == insn->kk) ==
+                (insn->id == OP_SE_Vx_byte))
+            {
+                ctx->reg.pc += 4;
+                return ERR_OK;
+            }
+            ctx->last.pc += 2;
+            ctx->last.op = next->op;
+            ctx->reg.pc += 4;
+            ret = op_JP_addr(ctx, next);
+            break;
+        case FUSE_LD_I_DRW:
+            ctx->reg.i = _NNN(insn->op);
+            ctx->last.pc += 2;
+            ctx->last.op = next->op;
+            ctx->reg.pc += 4;
+            ret = op_DRW_Vx_Vy_n(ctx, next);
+            break;
+        default:
+            ctx->reg.v[insn->x] += insn->kk;
+            ctx->last.pc += 2;
+            ctx->last.op = next->op;
+            ctx->reg.pc += 4;
+            if (next->id == OP_SE_Vx_byte)
+                ret = op_SE_Vx_byte(ctx, next);
+            else
+                ret = op_SNE_Vx_byte(ctx, next);
+            break;
+    }
+    (*n)++;
     return ret;
 }
 
-int c8_load(c8_t *ctx, uint16_t address, uint8_t *data, uint16_t size)
+/**
+ * The superinstruction at pc, NULL if there is none. Invalidated slots have
+ * no superinstruction either, and a pair whose second slot is not
+ * predecoded runs unfused: c8_clone may leave such a slot empty.
+ */
+static inline const insn_t *fused_at(c8_t *ctx)
 {
-    uint32_t end = (uint32_t)address + (uint32_t)size;
-    if (end >= MEM_SIZE)
-        return ERR_OUT_OF_MEM;
-    memcpy(&ctx->mem[address], data, size);
-    return ERR_OK;
+    const insn_t *insn;
+
+    if (ctx->reg.pc > MEM_SIZE - 2)
+        return NULL;
+    insn = &ctx->decoded[ctx->reg.pc];
+    return (insn->fuse && insn[2].fn) ? insn : NULL;
 }
 
-int c8_load_file(c8_t *ctx, const char *filename)
+#ifdef C8_THREADED
+
+/*
+ * Threaded core, built with -DC8_THREADED. Every handler is called directly
+ * (and inlined) from its own label, which then fetches the next instruction
+ * and jumps straight to that instruction's label.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+#define FETCH()                                                                \
+    do                                                                         \
+    {                                                                          \
+        if (n == budget)                                                       \
+            goto done;                                                         \
+        ctx->last.pc = ctx->reg.pc;                                            \
+        if (ctx->reg.pc > MEM_SIZE - 2)                                        \
+        {                                                                      \
+            ctx->last.op = 0;                                                  \
+            *ret = ERR_INVALID_OP;                                             \
+            goto done;                                                         \
+        }                                                                      \
+        insn = &ctx->decoded[ctx->reg.pc];                                     \
+        if (!insn->fn)                                                         \
+            insn = predecode(ctx, ctx->reg.pc);                                \
+        else if (insn->fuse && insn[2].fn && (budget - n >= 2) && fuse)        \
+            goto L_FUSED;                                                      \
+        ctx->last.op = insn->op;                                               \
+        ctx->reg.pc += 2;                                                      \
+        goto *labels[insn->id];                                                \
+    } while (0)
+
+#define HANDLER(name)                                                          \
+    L_##name:                                                                  \
+    *ret = op_##name(ctx, insn);                                               \
+    if (ctx->flags & FLAG_TRACE)                                               \
+        trace(ctx);                                                            \
+    n++;                                                                       \
+    if ((*ret != ERR_OK) || ctx->events)                                       \
+        goto done;                                                             \
+    FETCH()
+
+static unsigned int run_loop(c8_t *ctx, unsigned int budget, int *ret)
 {
-    FILE *file;
-    size_t nbytes;
+    static const void *labels[OP_COUNT] = {
+        [OP_INVALID] = &&L_INVALID,
+        [OP_CLS] = &&L_CLS,
+        [OP_RET] = &&L_RET,
+        [OP_JP_addr] = &&L_JP_addr,
+        [OP_CALL_addr] = &&L_CALL_addr,
+        [OP_SE_Vx_byte] = &&L_SE_Vx_byte,
+        [OP_SNE_Vx_byte] = &&L_SNE_Vx_byte,
+        [OP_SE_Vx_Vy] = &&L_SE_Vx_Vy,
+        [OP_LD_Vx_byte] = &&L_LD_Vx_byte,
+        [OP_ADD_Vx_byte] = &&L_ADD_Vx_byte,
+        [OP_LD_Vx_Vy] = &&L_LD_Vx_Vy,
+        [OP_OR_Vx_Vy] = &&L_OR_Vx_Vy,
+        [OP_AND_Vx_Vy] = &&L_AND_Vx_Vy,
+        [OP_XOR_Vx_Vy] = &&L_XOR_Vx_Vy,
+        [OP_ADD_Vx_Vy] = &&L_ADD_Vx_Vy,
+        [OP_SUB_Vx_Vy] = &&L_SUB_Vx_Vy,
+        [OP_SHR_Vx_Vy] = &&L_SHR_Vx_Vy,
+        [OP_SUBN_Vx_Vy] = &&L_SUBN_Vx_Vy,
+        [OP_SHL_Vx_Vy] = &&L_SHL_Vx_Vy,
+        [OP_SNE_Vx_Vy] = &&L_SNE_Vx_Vy,
+        [OP_LD_I_addr] = &&L_LD_I_addr,
+        [OP_JP_V0_addr] = &&L_JP_V0_addr,
+        [OP_RND_Vx_byte] = &&L_RND_Vx_byte,
+        [OP_DRW_Vx_Vy_n] = &&L_DRW_Vx_Vy_n,
+        [OP_SKNP_Vx] = &&L_SKNP_Vx,
+        [OP_SKP_Vx] = &&L_SKP_Vx,
+        [OP_LD_Vx_DT] = &&L_LD_Vx_DT,
+        [OP_LD_Vx_K] = &&L_LD_Vx_K,
+        [OP_LD_DT_Vx] = &&L_LD_DT_Vx,
+        [OP_LD_ST_Vx] = &&L_LD_ST_Vx,
+        [OP_ADD_I_Vx] = &&L_ADD_I_Vx,
+        [OP_LD_I_FONT_Vx] = &&L_LD_I_FONT_Vx,
+        [OP_LD_B_Vx] = &&L_LD_B_Vx,
+        [OP_LD_addrI_Vx] = &&L_LD_addrI_Vx,
+        [OP_LD_Vx_addrI] = &&L_LD_Vx_addrI,
+    };
+    const insn_t *insn;
+    unsigned int n = 0;
+    /* tracing shows every instruction on its own */
+    int fuse = !(ctx->flags & FLAG_TRACE);
+
+    *ret = ERR_OK;
+    FETCH();
+
+L_INVALID:
+    *ret = ERR_INVALID_OP;
+    if (ctx->flags & FLAG_TRACE)
+        trace(ctx);
+    ctx->reg.pc = ctx->last.pc;
+    goto done;
+
+L_FUSED:
+    *ret = execute_fused(ctx, insn, &n);
+    if ((*ret != ERR_OK) || ctx->events)
+        goto done;
+    FETCH();
+
+    HANDLER(CLS);
+    HANDLER(RET);
+    HANDLER(JP_addr);
+    HANDLER(CALL_addr);
+    HANDLER(SE_Vx_byte);
+    HANDLER(SNE_Vx_byte);
+    HANDLER(SE_Vx_Vy);
+    HANDLER(LD_Vx_byte);
+    HANDLER(ADD_Vx_byte);
+    HANDLER(LD_Vx_Vy);
+    HANDLER(OR_Vx_Vy);
+    HANDLER(AND_Vx_Vy);
+    HANDLER(XOR_Vx_Vy);
+    HANDLER(ADD_Vx_Vy);
+    HANDLER(SUB_Vx_Vy);
+    HANDLER(SHR_Vx_Vy);
+    HANDLER(SUBN_Vx_Vy);
+    HANDLER(SHL_Vx_Vy);
+    HANDLER(SNE_Vx_Vy);
+    HANDLER(LD_I_addr);
+    HANDLER(JP_V0_addr);
+    HANDLER(RND_Vx_byte);
+    HANDLER(DRW_Vx_Vy_n);
+    HANDLER(SKNP_Vx);
+    HANDLER(SKP_Vx);
+    HANDLER(LD_Vx_DT);
+    HANDLER(LD_Vx_K);
+    HANDLER(LD_DT_Vx);
+    HANDLER(LD_ST_Vx);
+    HANDLER(ADD_I_Vx);
+    HANDLER(LD_I_FONT_Vx);
+    HANDLER(LD_B_Vx);
+    HANDLER(LD_addrI_Vx);
+    HANDLER(LD_Vx_addrI);
+
+done:
+    return n;
+}
 
-    file = fopen(filename, "rb");
-    if (!file)
-        return ERR_FILE_NOT_FOUND;
+#undef HANDLER
+#undef FETCH
+#pragma GCC diagnostic pop
 
-    nbytes = fread(&ctx->mem[LOAD_ADDR], 1, MEM_SIZE -LOAD_ADDR, file);
-    fclose(file);
-    c8_set_pc(ctx, LOAD_ADDR);
-    return nbytes;
-}
+#else
 
-uint8_t c8_get_pixel(c8_t *ctx, uint8_t x, uint8_t y)
+static unsigned int run_loop(c8_t *ctx, unsigned int budget, int *ret)
 {
-    if ((x >= WIDTH) || (y >= HEIGHT))
-        return 0;
-    return ctx->disp[x][y];
+    unsigned int n = 0;
+
+    const insn_t *insn;
+    /* tracing shows every instruction on its own */
+    int fuse = !(ctx->flags & FLAG_TRACE);
+
+    *ret = ERR_OK;
+    while (n < budget)
+    {
+        /* both halves of a pair have to fit in the budget */
+        insn = (fuse && (budget - n >= 2)) ? fused_at(ctx) : NULL;
+        if (insn)
+            *ret = execute_fused(ctx, insn, &n);
+        else
+        {
+            *ret = execute(ctx);
+            if (*ret == ERR_INVALID_OP)
+                break;
+            n++;
+        }
+        if ((*ret != ERR_OK) || ctx->events)
+            break;
+    }
+    return n;
 }
 
-void c8_set_pc(c8_t *ctx, uint16_t pc)
+#endif /* C8_THREADED */
+
+#ifdef C8_JIT
+
+/*
+ * x86-64 dynamic recompiler.
+ *
+ * Straight-line runs of instructions that only touch registers, I and the
+ * delay timer are translated into native code, together with a closing
+ * JP/SE/SNE when there is one. A block is called as void fn(c8_t *ctx)
+ * (System V ABI, ctx in rdi), executes all of its instructions and leaves
+ * pc, last.pc and last.op as the interpreter would. Everything else,
+ * including blocks that do not fit in the remaining budget, is interpreted.
+ */
+#define JIT_CODE_SIZE 0x40000
+#define JIT_MAX_INSNS 64
+/*
+ * Worst case code size of one instruction, plus the block epilogue. The
+ * largest is LD VF, [I]: 7 + 16 * 19 + 7 = 318 bytes.
+ */
+#define JIT_MAX_INSN_CODE 320
+#define JIT_EPILOGUE_CODE 32
+
+typedef void (*jitfn)(c8_t *ctx);
+
+struct jit_block
+{
+    jitfn fn;
+    uint8_t count;
+    uint8_t compiled;
+};
+
+struct jit
+{
+    uint8_t *code;
+    size_t used;
+    struct jit_block block[MEM_SIZE];
+    /* addresses whose bytes were looked at by the translator */
+    uint8_t covered[MEM_SIZE / 8];
+};
+
+/* ModRM operands are always [rdi + disp32] */
+#define REG_AL 0
+#define REG_CL 1
+#define REG_DL 2
+#define DISP(field) ((int32_t)offsetof(c8_t, field))
+#define DISP_V(x) (DISP(reg.v) + (x))
+
+static void emit8(struct jit *jit, uint8_t byte)
+{
+    jit->code[jit->used++] = byte;
+}
+
+static void emit16(struct jit *jit, uint16_t value)
+{
+    emit8(jit, value & 0xFF);
+    emit8(jit, value >> 8);
+}
+
+static void emit32(struct jit *jit, uint32_t value)
+{
+    emit16(jit, value & 0xFFFF);
+    emit16(jit, value >> 16);
+}
+
+/* <op> reg, [rdi + disp] (or the reverse direction, depending on op) */
+static void emit_mem(struct jit *jit, uint8_t op, uint8_t reg, int32_t disp)
+{
+    emit8(jit, op);
+    emit8(jit, 0x80 | (reg << 3) | 0x07);
+    emit32(jit, disp);
+}
+
+/* two byte opcode 0F <op> with a memory operand */
+static void emit_mem_0f(struct jit *jit, uint8_t op, uint8_t reg, int32_t disp)
+{
+    emit8(jit, 0x0F);
+    emit_mem(jit, op, reg, disp);
+}
+
+/* mov al, [rdi + disp] */
+static void emit_load(struct jit *jit, int32_t disp)
+{
+    emit_mem(jit, 0x8A, REG_AL, disp);
+}
+
+/* mov [rdi + disp], al */
+static void emit_store(struct jit *jit, int32_t disp)
+{
+    emit_mem(jit, 0x88, REG_AL, disp);
+}
+
+/* mov word [rdi + disp], imm16 */
+static void emit_store16_imm(struct jit *jit, int32_t disp, uint16_t value)
+{
+    emit8(jit, 0x66);
+    emit_mem(jit, 0xC7, 0, disp);
+    emit16(jit, value);
+}
+
+/**
+ * Pick the next pc of a SE/SNE: eax = pc + 2, ecx = pc + 4, cmovcc eax, ecx
+ * and store ax in reg.pc. The flags must already hold the comparison.
+ */
+static void emit_skip(struct jit *jit, uint16_t pc, uint8_t cmov)
+{
+    emit8(jit, 0xB8);
+    emit32(jit, pc + 2);
+    emit8(jit, 0xB9);
+    emit32(jit, pc + 4);
+    emit8(jit, 0x0F);
+    emit8(jit, cmov);
+    emit8(jit, 0xC1);
+    emit8(jit, 0x66);
+    emit_mem(jit, 0x89, REG_AL, DISP(reg.pc));
+}
+
+#define CMOVE 0x44
+#define CMOVNE 0x45
+
+/**
+ * Emit the code for one instruction.
+ *
+ * Returns 1 if the instruction was translated and the block goes on, 2 if it
+ * was translated and ends the block (it set pc), 0 if it cannot be
+ * translated. Flag setting instructions reload their operands after writing
+ * VF, exactly like the handlers, so that x or y being F behaves the same.
+ */
+static int jit_translate(struct jit *jit, uint16_t pc, uint16_t opcode)
+{
+    uint8_t x = _X__(opcode);
+    uint8_t y = __Y_(opcode);
+    uint8_t kk = __KK(opcode);
+    uint8_t i;
+
+    switch (decode(opcode))
+    {
+        case OP_LD_Vx_byte:
+            emit_mem(jit, 0xC6, 0, DISP_V(x));
+            emit8(jit, kk);
+            return 1;
+        case OP_ADD_Vx_byte:
+            emit_mem(jit, 0x80, 0, DISP_V(x));
+            emit8(jit, kk);
+            return 1;
+        case OP_LD_Vx_Vy:
+            emit_load(jit, DISP_V(y));
+            emit_store(jit, DISP_V(x));
+            return 1;
+        case OP_OR_Vx_Vy:
+            emit_load(jit, DISP_V(y));
+            emit_mem(jit, 0x08, REG_AL, DISP_V(x));
+            return 1;
+        case OP_AND_Vx_Vy:
+            emit_load(jit, DISP_V(y));
+            emit_mem(jit, 0x20, REG_AL, DISP_V(x));
+            return 1;
+        case OP_XOR_Vx_Vy:
+            emit_load(jit, DISP_V(y));
+            emit_mem(jit, 0x30, REG_AL, DISP_V(x));
+            return 1;
+        case OP_ADD_Vx_Vy:
+            /* VF = Vx + Vy > 0xFF */
+            emit_load(jit, DISP_V(x));
+            emit_mem(jit, 0x02, REG_AL, DISP_V(y));
+            emit_mem_0f(jit, 0x92, 0, DISP_V(0xF));
+            emit_load(jit, DISP_V(x));
+            emit_mem(jit, 0x02, REG_AL, DISP_V(y));
+            emit_store(jit, DISP_V(x));
+            return 1;
+        case OP_SUB_Vx_Vy:
+            /* VF = Vx > Vy */
+            emit_load(jit, DISP_V(x));
+            emit_mem(jit, 0x3A, REG_AL, DISP_V(y));
+            emit_mem_0f(jit, 0x97, 0, DISP_V(0xF));
+            emit_load(jit, DISP_V(x));
+            emit_mem(jit, 0x2A, REG_AL, DISP_V(y));
+            emit_store(jit, DISP_V(x));
+            return 1;
+        case OP_SUBN_Vx_Vy:
+            /* VF = Vy > Vx */
+            emit_load(jit, DISP_V(y));
+            emit_mem(jit, 0x3A, REG_AL, DISP_V(x));
+            emit_mem_0f(jit, 0x97, 0, DISP_V(0xF));
+            emit_load(jit, DISP_V(y));
+            emit_mem(jit, 0x2A, REG_AL, DISP_V(x));
+            emit_store(jit, DISP_V(x));
+            return 1;
+        case OP_SHR_Vx_Vy:
+            /* and al, 1 */
+            emit_load(jit, DISP_V(y));
+            emit8(jit, 0x24);
+            emit8(jit, 0x01);
+            emit_store(jit, DISP_V(0xF));
+            /* shr al, 1 */
+            emit_load(jit, DISP_V(y));
+            emit8(jit, 0xD0);
+            emit8(jit, 0xE8);
+            emit_store(jit, DISP_V(x));
+            return 1;
+        case OP_SHL_Vx_Vy:
+            /* shr al, 7 */
+            emit_load(jit, DISP_V(y));
+            emit8(jit, 0xC0);
+            emit8(jit, 0xE8);
+            emit8(jit, 0x07);
+            emit_store(jit, DISP_V(0xF));
+            /* add al, al */
+            emit_load(jit, DISP_V(y));
+            emit8(jit, 0x00);
+            emit8(jit, 0xC0);
+            emit_store(jit, DISP_V(x));
+            return 1;
+        case OP_LD_I_addr:
+            emit_store16_imm(jit, DISP(reg.i), _NNN(opcode));
+            return 1;
+        case OP_ADD_I_Vx:
+            /* VF = I + Vx > 0xFFF, via movzx eax/ecx, add, cmp, seta */
+            emit_mem_0f(jit, 0xB7, REG_AL, DISP(reg.i));
+            emit_mem_0f(jit, 0xB6, REG_CL, DISP_V(x));
+            emit8(jit, 0x01);
+            emit8(jit, 0xC8);
+            emit8(jit, 0x3D);
+            emit32(jit, 0xFFF);
+            emit_mem_0f(jit, 0x97, 0, DISP_V(0xF));
+            emit_mem_0f(jit, 0xB7, REG_AL, DISP(reg.i));
+            emit_mem_0f(jit, 0xB6, REG_CL, DISP_V(x));
+            emit8(jit, 0x01);
+            emit8(jit, 0xC8);
+            emit8(jit, 0x66);
+            emit_mem(jit, 0x89, REG_AL, DISP(reg.i));
+            return 1;
+        case OP_LD_I_FONT_Vx:
+            /* movzx eax, Vx; lea eax, [rax + rax * 4]; mov I, ax */
+            emit_mem_0f(jit, 0xB6, REG_AL, DISP_V(x));
+            emit8(jit, 0x8D);
+            emit8(jit, 0x04);
+            emit8(jit, 0x80);
+            emit8(jit, 0x66);
+            emit_mem(jit, 0x89, REG_AL, DISP(reg.i));
+            return 1;
+        case OP_LD_Vx_DT:
+            emit_load(jit, DISP(reg.delay_timer));
+            emit_store(jit, DISP_V(x));
+            return 1;
+        case OP_LD_DT_Vx:
+            emit_load(jit, DISP_V(x));
+            emit_store(jit, DISP(reg.delay_timer));
+            return 1;
+        case OP_LD_Vx_addrI:
+            emit_mem_0f(jit, 0xB7, REG_AL, DISP(reg.i));
+            for (i = 0; i <= x; i++)
+            {
+                /* mov cl, [rdi + rax + mem] */
+                emit8(jit, 0x8A);
+                emit8(jit, 0x8C);
+                emit8(jit, 0x07);
+                emit32(jit, DISP(mem));
+                emit_mem(jit, 0x88, REG_CL, DISP_V(i));
+                /* inc ax; movzx eax, ax */
+                emit8(jit, 0x66);
+                emit8(jit, 0xFF);
+                emit8(jit, 0xC0);
+                emit8(jit, 0x0F);
+                emit8(jit, 0xB7);
+                emit8(jit, 0xC0);
+            }
+            emit8(jit, 0x66);
+            emit_mem(jit, 0x89, REG_AL, DISP(reg.i));
+            return 1;
+        case OP_JP_addr:
+            /* a jump to itself is left to the interpreter to report */
+            if (_NNN(opcode) == pc)
+                return 0;
+            emit_store16_imm(jit, DISP(reg.pc), _NNN(opcode));
+            return 2;
+        case OP_SE_Vx_byte:
+        case OP_SNE_Vx_byte:
+            /* cmp byte [Vx], kk */
+            emit_mem(jit, 0x80, 7, DISP_V(x));
+            emit8(jit, kk);
+            emit_skip(jit, pc,
+                      decode(opcode) == OP_SE_Vx_byte ? CMOVE : CMOVNE);
+            return 2;
+        case OP_SE_Vx_Vy:
+        case OP_SNE_Vx_Vy:
+            emit_load(jit, DISP_V(x));
+            emit_mem(jit, 0x3A, REG_AL, DISP_V(y));
+            emit_skip(jit, pc, decode(opcode) == OP_SE_Vx_Vy ? CMOVE : CMOVNE);
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+static void jit_flush(struct jit *jit)
+{
+    jit->used = 0;
+    memset(jit->block, 0, sizeof(jit->block));
+    memset(jit->covered, 0, sizeof(jit->covered));
+}
+
+/**
+ * Translate the block starting at pc. Blocks that do not start with a
+ * translatable instruction are remembered with a count of zero.
+ */
+static const struct jit_block *jit_compile(c8_t *ctx, uint16_t pc)
+{
+    struct jit *jit = ctx->jit;
+    struct jit_block *block;
+    uint16_t address = pc;
+    uint16_t opcode = 0;
+    uint8_t *start;
+    int res = 1;
+    unsigned int count = 0;
+    uint32_t a;
+
+    if (jit->used + JIT_MAX_INSN_CODE + JIT_EPILOGUE_CODE > JIT_CODE_SIZE)
+        jit_flush(jit);
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE))
+        return NULL;
+
+    block = &jit->block[pc];
+    start = &jit->code[jit->used];
+    /* a block that runs out of space ends early, the next one flushes */
+    while ((res == 1) && (count < JIT_MAX_INSNS) &&
+           (address <= MEM_SIZE - 2) &&
+           (jit->used + JIT_MAX_INSN_CODE + JIT_EPILOGUE_CODE <=
+            JIT_CODE_SIZE))
+    {
+        size_t used = jit->used;
+        uint16_t next = (ctx->mem[address] << 8) | ctx->mem[address + 1];
+
+        res = jit_translate(jit, address, next);
+        if (!res)
+        {
+            jit->used = used;
+            break;
+        }
+        opcode = next;
+        address += 2;
+        count++;
+    }
+
+    if (count)
+    {
+        /* pc, unless the last instruction already set it, and last */
+        if (res != 2)
+            emit_store16_imm(jit, DISP(reg.pc), address);
+        emit_store16_imm(jit, DISP(last.pc), address - 2);
+        emit_store16_imm(jit, DISP(last.op), opcode);
+        emit8(jit, 0xC3);
+        memcpy(&block->fn, &start, sizeof(block->fn));
+    }
+    block->count = count;
+    block->compiled = 1;
+
+    /* the bytes the decision was based on, including the refused opcode */
+    for (a = pc; (a < (uint32_t)address + 2) && (a < MEM_SIZE); a++)
+        jit->covered[a / 8] |= BIT(a % 8);
+
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC))
+    {
+        jit_flush(jit);
+        return NULL;
+    }
+    return block;
+}
+
+/**
+ * Drop all translations if any byte in [first, end) was translated.
+ */
+static void jit_invalidate(c8_t *ctx, uint32_t first, uint32_t end)
+{
+    uint32_t a;
+
+    for (a = first; a < end; a++)
+    {
+        if (ctx->jit->covered[a / 8] & BIT(a % 8))
+        {
+            jit_flush(ctx->jit);
+            return;
+        }
+    }
+}
+
+static unsigned int run_jit(c8_t *ctx, unsigned int budget, int *ret)
+{
+    const struct jit_block *block;
+    unsigned int n = 0;
+
+    *ret = ERR_OK;
+    while (n < budget)
+    {
+        block = NULL;
+        if (ctx->reg.pc <= MEM_SIZE - 2)
+        {
+            block = &ctx->jit->block[ctx->reg.pc];
+            if (!block->compiled)
+                block = jit_compile(ctx, ctx->reg.pc);
+        }
+
+        if (block && block->count && (block->count <= budget - n))
+        {
+            block->fn(ctx);
+            n += block->count;
+            continue;
+        }
+
+        *ret = execute(ctx);
+        if (*ret == ERR_INVALID_OP)
+            break;
+        n++;
+        if ((*ret != ERR_OK) || ctx->events)
+            break;
+    }
+    return n;
+}
+
+static void jit_destroy(c8_t *ctx)
+{
+    if (!ctx->jit)
+        return;
+    munmap(ctx->jit->code, JIT_CODE_SIZE);
+    free(ctx->jit);
+    ctx->jit = NULL;
+}
+
+int c8_set_jit(c8_t *ctx, int enable)
+{
+    void *code;
+
+    if (!enable)
+    {
+        jit_destroy(ctx);
+        return ERR_OK;
+    }
+    if (ctx->jit)
+        return ERR_OK;
+
+    ctx->jit = calloc(sizeof(struct jit), 1);
+    if (!ctx->jit)
+        return ERR_OUT_OF_MEM;
+    code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        free(ctx->jit);
+        ctx->jit = NULL;
+        return ERR_OUT_OF_MEM;
+    }
+    ctx->jit->code = code;
+    return ERR_OK;
+}
+
+#else
+
+int c8_set_jit(c8_t *ctx, int enable)
+{
+    (void)ctx;
+    return enable ? ERR_NOT_SUPPORTED : ERR_OK;
+}
+
+#endif /* C8_JIT */
+
+int c8_step(c8_t *ctx)
+{
+#ifdef C8_THREADED
+    int ret;
+
+    if (ctx->halted)
+        return ERR_HALTED;
+    (void)run_loop(ctx, 1, &ret);
+    return ret;
+#else
+    if (ctx->halted)
+        return ERR_HALTED;
+    return execute(ctx);
+#endif
+}
+
+/**
+ * The loop at pc was found idle after n instructions: time one round of it
+ * unless that was done already, then skip as many whole rounds as fit in
+ * the budget.
+ */
+static unsigned int idle_skip(c8_t *ctx, unsigned int budget, unsigned int n)
+{
+    unsigned int skip;
+
+    if (!ctx->idle.period)
+    {
+        if (!ctx->idle.measuring)
+        {
+            ctx->idle.measuring = 1;
+            ctx->idle.start = n;
+            return 0;
+        }
+        ctx->idle.measuring = 0;
+        ctx->idle.period = n - ctx->idle.start;
+    }
+    skip = (budget - n) / ctx->idle.period * ctx->idle.period;
+    ctx->stats.idle_skipped += skip;
+    return skip;
+}
+
+int c8_run(c8_t *ctx, unsigned int budget, int *reason)
+{
+    unsigned int n = 0;
+    int idle = 0;
+    int stop = STOP_BUDGET;
+    int ret;
+
+    if (ctx->halted)
+    {
+        if (reason)
+            *reason = STOP_HALTED;
+        return 0;
+    }
+
+    ctx->events = 0;
+    ctx->idle.measuring = 0;
+    do
+    {
+        ctx->events &= ~EVENT_IDLE;
+#ifdef C8_JIT
+        if (ctx->jit && !(ctx->flags & FLAG_TRACE))
+            n += run_jit(ctx, budget - n, &ret);
+        else
+#endif
+            n += run_loop(ctx, budget - n, &ret);
+        if ((ret != ERR_OK) || (ctx->events != EVENT_IDLE))
+            break;
+        n += idle_skip(ctx, budget, n);
+        idle = ctx->idle.period != 0;
+    } while (n < budget);
+
+    /* still in the idle loop, nothing to do until the next tick or key */
+    if (idle && (ret == ERR_OK) && !(ctx->events & ~EVENT_IDLE))
+    {
+        ctx->halted = 1;
+        ctx->wake = WAKE_TIMER | WAKE_KEY;
+    }
+
+    if (ret == ERR_INVALID_OP)
+        stop = STOP_INVALID_OP;
+    else if (ret == ERR_INFINIT_LOOP)
+        stop = STOP_INFINIT_LOOP;
+    else if (ctx->events & EVENT_DISPLAY)
+        stop = STOP_DISPLAY;
+    else if (ctx->events & EVENT_SOUND)
+        stop = STOP_SOUND;
+    else if (ctx->events & EVENT_KEY_WAIT)
+        stop = STOP_KEY_WAIT;
+
+    if (reason)
+        *reason = stop;
+    return n;
+}
+
+int c8_tick_60hz(c8_t *ctx)
+{
+    int ret = ERR_OK;
+
+    if (ctx->reg.delay_timer > 0)
+        ctx->reg.delay_timer--;
+    if (ctx->reg.sound_timer > 0)
+        ctx->reg.sound_timer--;
+    if (ctx->reg.sound_timer > 0)
+        ret = ERR_SOUND_ON;
+    if (ctx->wake & WAKE_TIMER)
+        ctx->halted = 0;
+
+    return ret;
+}
+
+int c8_load(c8_t *ctx, uint16_t address, uint8_t *data, uint16_t size)
+{
+    uint32_t end = (uint32_t)address + (uint32_t)size;
+    if (end >= MEM_SIZE)
+        return ERR_OUT_OF_MEM;
+    memcpy(&ctx->mem[address], data, size);
+    invalidate(ctx, address, size);
+    ctx->halted = 0;
+    return ERR_OK;
+}
+
+int c8_load_file(c8_t *ctx, const char *filename)
+{
+    FILE *file;
+    size_t nbytes;
+
+    file = fopen(filename, "rb");
+    if (!file)
+        return ERR_FILE_NOT_FOUND;
+
+    nbytes = fread(&ctx->mem[LOAD_ADDR], 1, MEM_SIZE -LOAD_ADDR, file);
+    fclose(file);
+    invalidate(ctx, LOAD_ADDR, nbytes);
+    c8_set_pc(ctx, LOAD_ADDR);
+    return nbytes;
+}
+
+uint8_t c8_get_pixel(c8_t *ctx, uint8_t x, uint8_t y)
+{
+    if ((x >= WIDTH) || (y >= HEIGHT))
+        return 0;
+    return (ctx->disp[y] >> (WIDTH - 1 - x)) & 1;
+}
+
+uint32_t c8_display_generation(c8_t *ctx)
+{
+    return ctx->generation;
+}
+
+int c8_get_dirty(c8_t *ctx, c8_rect_t *rect, uint32_t *rows)
+{
+    uint64_t cols = 0;
+    uint32_t dirty = 0;
+    int y;
+
+    /*
+     * Worked out here rather than in CLS and DRW: once per frame instead of
+     * once per sprite, and pixels turned back in between do not count.
+     */
+    for (y = 0; y < HEIGHT; y++)
+    {
+        uint64_t diff = ctx->disp[y] ^ ctx->shown[y];
+
+        dirty |= (uint32_t)(diff != 0) << y;
+        cols |= diff;
+    }
+    if (rows)
+        *rows = dirty;
+    if (!dirty)
+        return 0;
+
+    if (rect)
+    {
+        rect->x = __builtin_clzll(cols);
+        rect->w = WIDTH - __builtin_ctzll(cols) - rect->x;
+        rect->y = __builtin_ctz(dirty);
+        rect->h = HEIGHT - __builtin_clz(dirty) - rect->y;
+    }
+    memcpy(ctx->shown, ctx->disp, sizeof(ctx->shown));
+    return 1;
+}
+
+void c8_get_display(c8_t *ctx, uint64_t *rows)
+{
+    memcpy(rows, ctx->disp, sizeof(ctx->disp));
+}
+
+/*
+ * Row expansion. Every pixel is off ^ (mask & (on ^ off)), with the mask
+ * all ones for pixels that are set. The SSE2 versions build the masks for
+ * 4, 8 or 16 pixels at once by comparing the broadcast row bits against
+ * one bit per lane.
+ */
+#ifdef __SSE2__
+
+static void expand_row_32(uint64_t row, uint32_t *dst, uint32_t off,
+                          uint32_t on)
+{
+    const __m128i hi = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i lo = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+    const __m128i voff = _mm_set1_epi32(off);
+    const __m128i diff = _mm_set1_epi32(on ^ off);
+    int b;
+
+    for (b = 0; b < WIDTH / 8; b++)
+    {
+        __m128i bits = _mm_set1_epi32((row >> (WIDTH - 8 - 8 * b)) & 0xFF);
+        __m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(bits, hi), hi);
+        __m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(bits, lo), lo);
+
+        _mm_storeu_si128((__m128i *)&dst[8 * b],
+                         _mm_xor_si128(voff, _mm_and_si128(m0, diff)));
+        _mm_storeu_si128((__m128i *)&dst[8 * b + 4],
+                         _mm_xor_si128(voff, _mm_and_si128(m1, diff)));
+    }
+}
+
+static void expand_row_16(uint64_t row, uint16_t *dst, uint16_t off,
+                          uint16_t on)
+{
+    const __m128i sel = _mm_set_epi16(0x01, 0x02, 0x04, 0x08,
+                                      0x10, 0x20, 0x40, 0x80);
+    const __m128i voff = _mm_set1_epi16(off);
+    const __m128i diff = _mm_set1_epi16(on ^ off);
+    int b;
+
+    for (b = 0; b < WIDTH / 8; b++)
+    {
+        __m128i bits = _mm_set1_epi16((row >> (WIDTH - 8 - 8 * b)) & 0xFF);
+        __m128i m = _mm_cmpeq_epi16(_mm_and_si128(bits, sel), sel);
+
+        _mm_storeu_si128((__m128i *)&dst[8 * b],
+                         _mm_xor_si128(voff, _mm_and_si128(m, diff)));
+    }
+}
+
+static void expand_row_8(uint64_t row, uint8_t *dst, uint8_t off, uint8_t on)
+{
+    const __m128i sel = _mm_set1_epi64x(0x0102040810204080LL);
+    const __m128i voff = _mm_set1_epi8(off);
+    const __m128i diff = _mm_set1_epi8(on ^ off);
+    int b;
+
+    for (b = 0; b < WIDTH / 16; b++)
+    {
+        uint64_t b0 = (row >> (WIDTH - 8 - 16 * b)) & 0xFF;
+        uint64_t b1 = (row >> (WIDTH - 16 - 16 * b)) & 0xFF;
+        __m128i bits = _mm_set_epi64x(b1 * 0x0101010101010101ULL,
+                                      b0 * 0x0101010101010101ULL);
+        __m128i m = _mm_cmpeq_epi8(_mm_and_si128(bits, sel), sel);
+
+        _mm_storeu_si128((__m128i *)&dst[16 * b],
+                         _mm_xor_si128(voff, _mm_and_si128(m, diff)));
+    }
+}
+
+#else
+
+static void expand_row_32(uint64_t row, uint32_t *dst, uint32_t off,
+                          uint32_t on)
+{
+    int x;
+
+    for (x = 0; x < WIDTH; x++)
+        dst[x] = off ^ (-(uint32_t)((row >> (WIDTH - 1 - x)) & 1) & (on ^ off));
+}
+
+static void expand_row_16(uint64_t row, uint16_t *dst, uint16_t off,
+                          uint16_t on)
+{
+    int x;
+
+    for (x = 0; x < WIDTH; x++)
+        dst[x] = off ^ (-(uint16_t)((row >> (WIDTH - 1 - x)) & 1) & (on ^ off));
+}
+
+static void expand_row_8(uint64_t row, uint8_t *dst, uint8_t off, uint8_t on)
+{
+    int x;
+
+    for (x = 0; x < WIDTH; x++)
+        dst[x] = off ^ (-(uint8_t)((row >> (WIDTH - 1 - x)) & 1) & (on ^ off));
+}
+
+#endif /* __SSE2__ */
+
+static void expand_row(uint64_t row, uint8_t *dst, int format,
+                       const uint32_t palette[2])
+{
+    switch (format)
+    {
+        case C8_FORMAT_8:
+            expand_row_8(row, dst, palette[0], palette[1]);
+            break;
+        case C8_FORMAT_16:
+            expand_row_16(row, (uint16_t *)dst, palette[0], palette[1]);
+            break;
+        default:
+            expand_row_32(row, (uint32_t *)dst, palette[0], palette[1]);
+            break;
+    }
+}
+
+int c8_render_display(c8_t *ctx, void *pixels, int pitch, int format,
+                      const uint32_t palette[2])
+{
+    return c8_render_rect(ctx, pixels, pitch, format, palette, NULL);
+}
+
+int c8_render_rect(c8_t *ctx, void *pixels, int pitch, int format,
+                   const uint32_t palette[2], const c8_rect_t *rect)
+{
+    uint32_t tmp[WIDTH];
+    uint8_t *line = pixels;
+    int x0 = 0, y0 = 0, x1 = WIDTH, y1 = HEIGHT;
+    int y;
+
+    if ((format != C8_FORMAT_8) && (format != C8_FORMAT_16) &&
+        (format != C8_FORMAT_32))
+        return ERR_NOT_SUPPORTED;
+
+    if (rect)
+    {
+        x0 = rect->x < 0 ? 0 : rect->x;
+        y0 = rect->y < 0 ? 0 : rect->y;
+        x1 = rect->x + rect->w > WIDTH ? WIDTH : rect->x + rect->w;
+        y1 = rect->y + rect->h > HEIGHT ? HEIGHT : rect->y + rect->h;
+    }
+
+    for (y = y0, line += y0 * pitch; y < y1; y++, line += pitch)
+    {
+        if ((x0 == 0) && (x1 == WIDTH))
+            expand_row(ctx->disp[y], line, format, palette);
+        else if (x0 < x1)
+        {
+            /* only the part inside the rectangle is written */
+            expand_row(ctx->disp[y], (uint8_t *)tmp, format, palette);
+            memcpy(line + x0 * format, (uint8_t *)tmp + x0 * format,
+                   (x1 - x0) * format);
+        }
+    }
+    return ERR_OK;
+}
+
+c8_regs_t *c8_get_regs(c8_t *ctx)
+{
+    return &ctx->reg;
+}
+
+const uint8_t *c8_get_mem(c8_t *ctx)
+{
+    return ctx->mem;
+}
+
+/* copy count values of size bytes between host order and little-endian */
+static void copy_le(void *dst, const void *src, int count, int size)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    int i, b;
+
+    for (i = 0; i < count; i++, d += size, s += size)
+        for (b = 0; b < size; b++)
+            d[b] = s[size - 1 - b];
+#else
+    memcpy(dst, src, count * size);
+#endif
+}
+
+size_t c8_state_size(void)
+{
+    return sizeof(struct state);
+}
+
+void c8_save_state(c8_t *ctx, void *buf)
+{
+    uint8_t *state = buf;
+    uint32_t version = STATE_VERSION;
+
+    memcpy(STATE_AT(state, magic), STATE_MAGIC, 4);
+    copy_le(STATE_AT(state, version), &version, 1, 4);
+    copy_le(STATE_AT(state, pc), &ctx->reg.pc, 1, 2);
+    copy_le(STATE_AT(state, i), &ctx->reg.i, 1, 2);
+    copy_le(STATE_AT(state, stack), ctx->stack, 16, 2);
+    copy_le(STATE_AT(state, keys), &ctx->keys, 1, 2);
+    memcpy(STATE_AT(state, v), ctx->reg.v, 16);
+    *STATE_AT(state, sp) = ctx->reg.sp;
+    *STATE_AT(state, sound_timer) = ctx->reg.sound_timer;
+    *STATE_AT(state, delay_timer) = ctx->reg.delay_timer;
+    *STATE_AT(state, halted) = ctx->halted;
+    *STATE_AT(state, wake) = ctx->wake;
+    memset(STATE_AT(state, reserved), 0, sizeof(((struct state *)0)->reserved));
+    copy_le(STATE_AT(state, rng), &ctx->rng, 1, 8);
+    copy_le(STATE_AT(state, disp), ctx->disp, HEIGHT, 8);
+    memcpy(STATE_AT(state, mem), ctx->mem, MEM_SIZE);
+}
+
+int c8_load_state(c8_t *ctx, const void *buf)
+{
+    const uint8_t *state = buf;
+    uint32_t version;
+    uint16_t pc;
+    uint64_t rng;
+    uint32_t a;
+
+    copy_le(&version, STATE_AT(state, version), 1, 4);
+    copy_le(&pc, STATE_AT(state, pc), 1, 2);
+    copy_le(&rng, STATE_AT(state, rng), 1, 8);
+    if (memcmp(STATE_AT(state, magic), STATE_MAGIC, 4) ||
+        (version != STATE_VERSION) || (pc >= MEM_SIZE) ||
+        (*STATE_AT(state, sp) > 16) || !rng)
+        return ERR_BAD_STATE;
+
+    /* states of the same program share most of their memory */
+    for (a = 0; a < MEM_SIZE; a += STATE_BLOCK)
+    {
+        if (memcmp(&ctx->mem[a], STATE_AT(state, mem) + a, STATE_BLOCK))
+        {
+            memcpy(&ctx->mem[a], STATE_AT(state, mem) + a, STATE_BLOCK);
+            invalidate(ctx, a, STATE_BLOCK);
+        }
+    }
+
+    ctx->reg.pc = pc;
+    copy_le(&ctx->reg.i, STATE_AT(state, i), 1, 2);
+    copy_le(ctx->stack, STATE_AT(state, stack), 16, 2);
+    copy_le(&ctx->keys, STATE_AT(state, keys), 1, 2);
+    memcpy(ctx->reg.v, STATE_AT(state, v), 16);
+    ctx->reg.sp = *STATE_AT(state, sp);
+    ctx->reg.sound_timer = *STATE_AT(state, sound_timer);
+    ctx->reg.delay_timer = *STATE_AT(state, delay_timer);
+    ctx->halted = *STATE_AT(state, halted);
+    ctx->wake = *STATE_AT(state, wake);
+    ctx->rng = rng;
+    copy_le(ctx->disp, STATE_AT(state, disp), HEIGHT, 8);
+
+    /* whatever was learnt about the previous state no longer holds */
+    ctx->generation++;
+    ctx->effects++;
+    ctx->events = 0;
+    return ERR_OK;
+}
+
+size_t c8_size(void)
+{
+    return sizeof(c8_t);
+}
+
+void c8_clone(c8_t *dst, const c8_t *src)
+{
+    uint32_t a, first;
+    int changed = 0;
+
+    if (dst == src)
+        return;
+
+    /*
+     * dst already has its memory predecoded: only the slots that overlap
+     * blocks where src differs are taken from src, as invalidate would drop
+     * them.
+     */
+    for (a = 0; a < MEM_SIZE; a += STATE_BLOCK)
+    {
+        if (memcmp(&dst->mem[a], &src->mem[a], STATE_BLOCK))
+        {
+            first = a > 3 ? a - 3 : 0;
+            memcpy(&dst->decoded[first], &src->decoded[first],
+                   (a + STATE_BLOCK - first) * sizeof(insn_t));
+            changed = 1;
+        }
+    }
+#ifdef C8_JIT
+    /* translations only depend on the memory */
+    if (changed && dst->jit)
+        jit_flush(dst->jit);
+#else
+    (void)changed;
+#endif
+    memcpy(dst, src, offsetof(c8_t, decoded));
+}
+
+c8_t *c8_clone_into(void *mem, const c8_t *src)
+{
+    c8_t *dst = mem;
+
+    memcpy(dst, src, sizeof(c8_t));
+    dst->jit = NULL;
+    return dst;
+}
+
+const c8_stats_t *c8_get_stats(c8_t *ctx)
+{
+    return &ctx->stats;
+}
+
+void c8_set_pc(c8_t *ctx, uint16_t pc)
 {
     ctx->reg.pc = pc;
+    ctx->halted = 0;
+}
+
+int c8_halted(c8_t *ctx, int *wake)
+{
+    if (wake)
+        *wake = ctx->halted ? ctx->wake : WAKE_NONE;
+    return ctx->halted;
 }
 
 void c8_set_keys(c8_t *ctx, uint16_t keys)
 {
+    if ((ctx->wake & WAKE_KEY) && (keys != ctx->keys))
+        ctx->halted = 0;
     ctx->keys = keys;
+    /* idle loops may be waiting for exactly this */
+    ctx->effects++;
 }
 
 void c8_debug_dump_memory(c8_t *ctx, uint16_t address, uint16_t length)
@@ -740,7 +2356,7 @@ void c8_debug_dump_display(c8_t *ctx)
         fprintf(stderr, "%2d", y);
         for (x = 0; x < WIDTH; x++)
         {
-            fprintf(stderr, "%c", ctx->disp[x][y] ? 'x' : ' ');
+            fprintf(stderr, "%c", c8_get_pixel(ctx, x, y) ? 'x' : ' ');
         }
         fprintf(stderr, "\n");
     }
@@ -758,5 +2374,6 @@ char *c8_debug_get_last(c8_t *ctx, uint16_t *op, uint16_t *pc)
 {
     *op = ctx->last.op;
     *pc = ctx->last.pc;
+    disasm(ctx->last.op, ctx->last.opstr, OPSTRLEN);
     return ctx->last.opstr;
 }
\ No newline at end of file
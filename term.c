@@ -0,0 +1,89 @@
+#include <string.h>
+#include "term.h"
+
+/*
+ * Unchanged cells between two changed ones are cheaper to print again than
+ * to jump over: a cursor move takes up to 7 bytes, a cell 3.
+ */
+#define TERM_GAP 2
+
+/* worst case: every cell changed and needs its own cursor move */
+#define TERM_BUF_SIZE (TERM_ROWS * TERM_COLS * (7 + 3) + 16)
+
+/* braille dots for cell column cx of the 4 lines starting at rows */
+static uint8_t cell(const uint64_t *rows, int cx)
+{
+    int shift = C8_WIDTH - 2 - 2 * cx;
+    unsigned r0 = (rows[0] >> shift) & 3;
+    unsigned r1 = (rows[1] >> shift) & 3;
+    unsigned r2 = (rows[2] >> shift) & 3;
+    unsigned r3 = (rows[3] >> shift) & 3;
+
+    /* left column is dots 1, 2, 3, 7, right column dots 4, 5, 6, 8 */
+    return (r0 >> 1) | ((r1 >> 1) << 1) | ((r2 >> 1) << 2) |
+           ((r0 & 1) << 3) | ((r1 & 1) << 4) | ((r2 & 1) << 5) |
+           ((r3 >> 1) << 6) | ((r3 & 1) << 7);
+}
+
+void term_init(term_t *term, FILE *out)
+{
+    term->valid = 0;
+    fputs("\x1b[?25l\x1b[2J", out);
+}
+
+size_t term_frame(term_t *term, const uint64_t *rows, FILE *out)
+{
+    char buf[TERM_BUF_SIZE];
+    char *p = buf;
+    uint8_t cells[TERM_COLS];
+    int x, y;
+
+    for (y = 0; y < TERM_ROWS; y++)
+    {
+        for (x = 0; x < TERM_COLS; x++)
+            cells[x] = cell(&rows[4 * y], x);
+
+        x = 0;
+        while (x < TERM_COLS)
+        {
+            int start, end;
+
+            if (term->valid && (cells[x] == term->cells[y][x]))
+            {
+                x++;
+                continue;
+            }
+            /* extend the run over short gaps of unchanged cells */
+            start = x;
+            end = x + 1;
+            for (x++; (x < TERM_COLS) && (x - end < TERM_GAP + 1); x++)
+                if (!term->valid || (cells[x] != term->cells[y][x]))
+                    end = x + 1;
+
+            p += sprintf(p, "\x1b[%d;%dH", y + 1, start + 1);
+            for (x = start; x < end; x++)
+            {
+                /* U+2800 + dots in UTF-8 */
+                *p++ = (char)0xE2;
+                *p++ = (char)(0xA0 | (cells[x] >> 6));
+                *p++ = (char)(0x80 | (cells[x] & 0x3F));
+                term->cells[y][x] = cells[x];
+            }
+        }
+    }
+    term->valid = 1;
+
+    if (p != buf)
+    {
+        fwrite(buf, p - buf, 1, out);
+        fflush(out);
+    }
+    return p - buf;
+}
+
+void term_end(term_t *term, FILE *out)
+{
+    (void)term;
+    fprintf(out, "\x1b[%d;1H\x1b[?25h", TERM_ROWS + 1);
+    fflush(out);
+}
@@ -0,0 +1,34 @@
+#ifndef TERM_H
+#define TERM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <c8.h>
+
+/* one braille character covers 2x4 pixels */
+#define TERM_COLS (C8_WIDTH / 2)
+#define TERM_ROWS (C8_HEIGHT / 4)
+
+/* what is on the terminal, to redraw only the difference */
+typedef struct
+{
+    uint8_t cells[TERM_ROWS][TERM_COLS];
+    int valid;
+} term_t;
+
+/**
+ * Start drawing at the top left corner of a cleared terminal, with the
+ * cursor hidden.
+ */
+void term_init(term_t *term, FILE *out);
+
+/**
+ * Draw a display, as packed by c8_get_display, with one write for the cells
+ * that changed since the last frame. Returns the number of bytes written.
+ */
+size_t term_frame(term_t *term, const uint64_t *rows, FILE *out);
+
+/* put the cursor back below the display */
+void term_end(term_t *term, FILE *out);
+
+#endif
@@ -3,8 +3,21 @@
 #include <string.h>
 /* we want the access internal structures */
 #include "../src/c8.c"
+#include "../rewind.c"
 
 
+/*
+ * last.opstr is only rendered when asked for, so the disassembly checks
+ * go through c8_debug_get_last. The expected strings are the same as
+ * when every handler filled last.opstr.
+ */
+static const char *last_opstr(c8_t *ctx)
+{
+    uint16_t op, pc;
+
+    return c8_debug_get_last(ctx, &op, &pc);
+}
+
 static void test_load()
 {
     c8_t *ctx;
@@ -45,6 +58,35 @@ static void test_op_invalid()
 }
 
 
+static void test_op_invalid_groups()
+{
+    unsigned int i;
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x01, 0x23, // SYS 0x123
+            0x00, 0xE1, // 0nnn only decodes as 00E0/00EE
+            0x51, 0x21, // 5xy1
+            0x80, 0x18, // 8xy8
+            0x80, 0x1F, // 8xyF
+            0x91, 0x2E, // 9xyE
+            0xE0, 0x9F, // Ex9F
+            0xF0, 0x00, // Fx00
+            0xF0, 0x66, // Fx66
+    };
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0, code, sizeof(code)));
+
+    for (i = 0; i < sizeof(code); i += 2)
+    {
+        c8_set_pc(ctx, i);
+        TEST_ASSERT_EQUAL(ERR_INVALID_OP, c8_step(ctx));
+        TEST_ASSERT_EQUAL(i, ctx->reg.pc);
+    }
+}
+
+
 static void test_op_JP_addr()
 {
     c8_t *ctx;
@@ -62,7 +104,7 @@ static void test_op_JP_addr()
     TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
 
     TEST_ASSERT_EQUAL(0x678, ctx->reg.pc);
-    TEST_ASSERT_EQUAL_STRING("JP\t0x678", ctx->last.opstr);
+    TEST_ASSERT_EQUAL_STRING("JP\t0x678", last_opstr(ctx));
 
     c8_set_pc(ctx, 4);
     TEST_ASSERT_EQUAL(4, ctx->reg.pc);
@@ -124,7 +166,7 @@ void test_op_skip()
     TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
     TEST_ASSERT_EQUAL(36, ctx->reg.pc);
 
-    TEST_ASSERT_EQUAL_STRING("SNE\tV2,\tV3", ctx->last.opstr);
+    TEST_ASSERT_EQUAL_STRING("SNE\tV2,\tV3", last_opstr(ctx));
 }
 
 static void test_op_LD_Vx_byte()
@@ -152,7 +194,7 @@ static void test_op_LD_Vx_byte()
     TEST_ASSERT_EQUAL_HEX8(0x12, ctx->reg.v[0xb]);
     TEST_ASSERT_EQUAL_HEX8(0x36, ctx->reg.v[0xe]);
 
-    TEST_ASSERT_EQUAL_STRING("LD\tVE,\t0x36", ctx->last.opstr);
+    TEST_ASSERT_EQUAL_STRING("LD\tVE,\t0x36", last_opstr(ctx));
 }
 
 
@@ -179,7 +221,7 @@ void test_op_ADD_Vx_byte()
     TEST_ASSERT_EQUAL_HEX8(0x2c, ctx->reg.v[4]);
     TEST_ASSERT_EQUAL_HEX8(0x89, ctx->reg.v[2]);
 
-    TEST_ASSERT_EQUAL_STRING("ADD\tV2,\t0x99", ctx->last.opstr);
+    TEST_ASSERT_EQUAL_STRING("ADD\tV2,\t0x99", last_opstr(ctx));
 }
 
 
@@ -205,7 +247,7 @@ void test_op_LD_I_addr()
     TEST_ASSERT_EQUAL(4, ctx->reg.pc);
     TEST_ASSERT_EQUAL_HEX16(0x456, ctx->reg.i);
 
-    TEST_ASSERT_EQUAL_STRING("LD\tI,\t0x456", ctx->last.opstr);
+    TEST_ASSERT_EQUAL_STRING("LD\tI,\t0x456", last_opstr(ctx));
 }
 
 
@@ -225,7 +267,7 @@ void test_op_JP_V0_addr()
     TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
     TEST_ASSERT_EQUAL(0x26a, ctx->reg.pc);
 
-    TEST_ASSERT_EQUAL_STRING("JP\tV0,\t0x234", ctx->last.opstr);
+    TEST_ASSERT_EQUAL_STRING("JP\tV0,\t0x234", last_opstr(ctx));
 }
 
 
@@ -271,7 +313,7 @@ static void test_op_subroutine()
     TEST_ASSERT_EQUAL(4, ctx->reg.pc);
     TEST_ASSERT_EQUAL(0, ctx->reg.sp);
 
-    TEST_ASSERT_EQUAL_STRING("RET", ctx->last.opstr);
+    TEST_ASSERT_EQUAL_STRING("RET", last_opstr(ctx));
 }
 
 void test_op_OP_Vx_Vy()
@@ -419,7 +461,7 @@ void test_op_OP_Vx_Vy()
     TEST_ASSERT_EQUAL_HEX8(0x0e, ctx->reg.v[0]);
     TEST_ASSERT_EQUAL_HEX8(1, ctx->reg.v[0xf]);
 
-    TEST_ASSERT_EQUAL_STRING("SHL\tV0,\tV1", ctx->last.opstr);
+    TEST_ASSERT_EQUAL_STRING("SHL\tV0,\tV1", last_opstr(ctx));
 }
 
 static void test_op_Fxxx_timers()
@@ -457,7 +499,7 @@ static void test_op_Fxxx_timers()
 
     TEST_ASSERT_EQUAL(ERR_OK, c8_tick_60hz(ctx));
 
-    TEST_ASSERT_EQUAL_STRING("LD\tST,\tV1", ctx->last.opstr);
+    TEST_ASSERT_EQUAL_STRING("LD\tST,\tV1", last_opstr(ctx));
 }
 
 static void test_op_Fxxx_push_pop()
@@ -552,6 +594,1353 @@ static void test_op_Fxxx_misc()
     TEST_ASSERT_EQUAL(5, ctx->mem[0x105]);
 }
 
+static void test_op_LD_Vx_K()
+{
+    c8_t *ctx;
+    uint8_t code[] = {
+            0xF3, 0x0A, // 000: LD V3, K
+    };
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0, code, sizeof(code)));
+
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(0, ctx->reg.pc);
+    TEST_ASSERT_EQUAL(ERR_HALTED, c8_step(ctx));
+    TEST_ASSERT_EQUAL(0, ctx->reg.pc);
+
+    c8_set_keys(ctx, BIT(0xA) | BIT(0xC));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(2, ctx->reg.pc);
+    TEST_ASSERT_EQUAL_HEX8(0xA, ctx->reg.v[3]);
+
+    TEST_ASSERT_EQUAL_STRING("LD\tV3,\tK", last_opstr(ctx));
+}
+
+static void test_op_DRW()
+{
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x60, 0x3C, // 000: LD V0, 0x3C
+            0x61, 0x1D, // 002: LD V1, 0x1D
+            0xA0, 0x00, // 004: LD I, 0x000
+            0xD0, 0x15, // 006: DRW V0, V1, 5
+            0xD0, 0x15, // 008: DRW V0, V1, 5
+            0x60, 0x41, // 00a: LD V0, 0x41
+            0xD0, 0x11, // 00c: DRW V0, V1, 1
+            0x00, 0xE0, // 00e: CLS
+    };
+    int x, y;
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x100, code, sizeof(code)));
+    c8_set_pc(ctx, 0x100);
+
+    /* the "0" glyph at (60, 29), clipped at the right and bottom edges */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX8(0, ctx->reg.v[0xF]);
+    TEST_ASSERT_EQUAL_STRING("DRW\tV0,\tV1,\t0x5", last_opstr(ctx));
+    for (x = 60; x < 64; x++)
+        TEST_ASSERT_EQUAL(1, c8_get_pixel(ctx, x, 29));
+    TEST_ASSERT_EQUAL(1, c8_get_pixel(ctx, 60, 30));
+    TEST_ASSERT_EQUAL(0, c8_get_pixel(ctx, 61, 30));
+    TEST_ASSERT_EQUAL(1, c8_get_pixel(ctx, 63, 31));
+    TEST_ASSERT_EQUAL(0, c8_get_pixel(ctx, 0, 29));
+    TEST_ASSERT_EQUAL(0, c8_get_pixel(ctx, 60, 0));
+    TEST_ASSERT_EQUAL(0, c8_get_pixel(ctx, 64, 29));
+
+    /* drawing it again erases it and reports the collision */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX8(1, ctx->reg.v[0xF]);
+    for (y = 0; y < 32; y++)
+        for (x = 0; x < 64; x++)
+            TEST_ASSERT_EQUAL(0, c8_get_pixel(ctx, x, y));
+
+    /* coordinates wrap, sprites do not */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX8(0, ctx->reg.v[0xF]);
+    for (x = 1; x < 5; x++)
+        TEST_ASSERT_EQUAL(1, c8_get_pixel(ctx, x, 29));
+    TEST_ASSERT_EQUAL(0, c8_get_pixel(ctx, 0, 29));
+    TEST_ASSERT_EQUAL(0, c8_get_pixel(ctx, 5, 29));
+
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(0, c8_get_pixel(ctx, 1, 29));
+    c8_destroy(ctx);
+}
+
+static void test_display_generation()
+{
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x00, 0xE0, // 000: CLS
+            0xA3, 0x00, // 002: LD I, 0x300
+            0xD0, 0x05, // 004: DRW V0, V0, 5
+            0xA0, 0x00, // 006: LD I, 0x000
+            0xD0, 0x05, // 008: DRW V0, V0, 5
+            0xD0, 0x05, // 00a: DRW V0, V0, 5
+            0xD0, 0x05, // 00c: DRW V0, V0, 5
+            0x00, 0xE0, // 00e: CLS
+    };
+    uint32_t gen;
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x100, code, sizeof(code)));
+    c8_set_pc(ctx, 0x100);
+    gen = c8_display_generation(ctx);
+
+    /* clearing a blank screen and drawing a blank sprite change nothing */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(gen, c8_display_generation(ctx));
+
+    /* drawing, erasing and drawing again do */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(gen + 1, c8_display_generation(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(gen + 2, c8_display_generation(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(gen + 3, c8_display_generation(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(gen + 4, c8_display_generation(ctx));
+    c8_destroy(ctx);
+}
+
+static void test_dirty_rect()
+{
+    static const uint32_t palette[2] = {0xFF102030, 0xFFC0D0E0};
+    static uint32_t pixels[C8_HEIGHT][C8_WIDTH];
+    c8_t *ctx;
+    c8_rect_t rect = {0, 0, 0, 0};
+    uint32_t rows;
+    uint8_t code[] = {
+            0x60, 0x05, // 000: LD V0, 0x05
+            0x61, 0x07, // 002: LD V1, 0x07
+            0xD0, 0x15, // 004: DRW V0, V1, 5
+            0x60, 0x3E, // 006: LD V0, 0x3E
+            0xD0, 0x15, // 008: DRW V0, V1, 5
+            0x00, 0xE0, // 00a: CLS
+    };
+    int x, y;
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x100, code, sizeof(code)));
+    c8_set_pc(ctx, 0x100);
+    TEST_ASSERT_EQUAL(0, c8_get_dirty(ctx, &rect, &rows));
+    TEST_ASSERT_EQUAL(0, rows);
+
+    /* the "0" glyph is 4 pixels wide */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(1, c8_get_dirty(ctx, &rect, &rows));
+    TEST_ASSERT_EQUAL(5, rect.x);
+    TEST_ASSERT_EQUAL(7, rect.y);
+    TEST_ASSERT_EQUAL(4, rect.w);
+    TEST_ASSERT_EQUAL(5, rect.h);
+    TEST_ASSERT_EQUAL_HEX32(0x1F << 7, rows);
+    TEST_ASSERT_EQUAL(0, c8_get_dirty(ctx, NULL, NULL));
+
+    /* clipped at the right edge, both sprites are cleared */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(1, c8_get_dirty(ctx, &rect, NULL));
+    TEST_ASSERT_EQUAL(62, rect.x);
+    TEST_ASSERT_EQUAL(2, rect.w);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(1, c8_get_dirty(ctx, &rect, NULL));
+    TEST_ASSERT_EQUAL(5, rect.x);
+    TEST_ASSERT_EQUAL(7, rect.y);
+    TEST_ASSERT_EQUAL(59, rect.w);
+    TEST_ASSERT_EQUAL(5, rect.h);
+
+    /* drawing a sprite and erasing it again changes nothing */
+    c8_set_pc(ctx, 0x108);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    c8_set_pc(ctx, 0x108);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(0, c8_get_dirty(ctx, NULL, NULL));
+
+    /* only the rectangle is written */
+    rect.x = 3;
+    rect.y = 30;
+    rect.w = 100;
+    rect.h = 100;
+    memset(pixels, 0xAA, sizeof(pixels));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_render_rect(ctx, pixels, sizeof(pixels[0]),
+                                             C8_FORMAT_32, palette, &rect));
+    for (y = 0; y < C8_HEIGHT; y++)
+        for (x = 0; x < C8_WIDTH; x++)
+            TEST_ASSERT_EQUAL_HEX32((x >= 3 && y >= 30) ? palette[0] :
+                                    0xAAAAAAAA, pixels[y][x]);
+    c8_destroy(ctx);
+}
+
+/* a frontend keeping its own copy of the display from draw events */
+static uint64_t draw_rows[C8_HEIGHT];
+static int draw_count;
+
+static void draw_cb(void *user, const c8_draw_t *draw)
+{
+    int y;
+
+    TEST_ASSERT_EQUAL_PTR(&draw_count, user);
+    draw_count++;
+    if (draw->type == C8_DRAW_CLS)
+    {
+        memset(draw_rows, 0, sizeof(draw_rows));
+        return;
+    }
+    TEST_ASSERT_EQUAL(C8_DRAW_SPRITE, draw->type);
+    for (y = 0; (y < draw->n) && (draw->y + y < C8_HEIGHT); y++)
+        draw_rows[draw->y + y] ^= ((uint64_t)draw->sprite[y] << 56) >> draw->x;
+}
+
+static void test_draw_callback()
+{
+    uint64_t rows[C8_HEIGHT];
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x60, 0x3C, // 000: LD V0, 0x3C
+            0x61, 0x1E, // 002: LD V1, 0x1E
+            0xF2, 0x29, // 004: LD F, V2
+            0xD0, 0x15, // 006: DRW V0, V1, 5
+            0xD1, 0x05, // 008: DRW V1, V0, 5
+            0xD1, 0x05, // 00a: DRW V1, V0, 5
+            0x00, 0xE0, // 00c: CLS
+            0xD0, 0x15, // 00e: DRW V0, V1, 5
+    };
+    int i;
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x100, code, sizeof(code)));
+    c8_set_pc(ctx, 0x100);
+    c8_set_draw_callback(ctx, draw_cb, &draw_count);
+
+    for (i = 0; i < 8; i++)
+    {
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+        c8_get_display(ctx, rows);
+        TEST_ASSERT_EQUAL_MEMORY(rows, draw_rows, sizeof(rows));
+        /* the second DRW V1, V0 erases the first one */
+        if (i == 5)
+            TEST_ASSERT_EQUAL(1, c8_get_regs(ctx)->v[0xF]);
+    }
+    TEST_ASSERT_EQUAL(5, draw_count);
+
+    /* and nothing once unregistered */
+    c8_set_draw_callback(ctx, NULL, NULL);
+    c8_set_pc(ctx, 0x10C);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(5, draw_count);
+    c8_destroy(ctx);
+}
+
+static void test_rng()
+{
+    c8_t *a, *b;
+    uint8_t *state;
+    uint8_t code[] = {
+            0xC0, 0xFF, // 000: RND V0, 0xFF
+            0x12, 0x00, // 002: JP 0x200
+    };
+    uint8_t seq[16];
+    int i, same = 1;
+
+    a = c8_create();
+    b = c8_create();
+    state = malloc(c8_state_size());
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_NOT_NULL(state);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(a, 0x200, code, sizeof(code)));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(b, 0x200, code, sizeof(code)));
+    c8_set_pc(a, 0x200);
+    c8_set_pc(b, 0x200);
+
+    /* the same seed gives the same numbers */
+    for (i = 0; i < 16; i++)
+    {
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(a));
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(a));
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(b));
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(b));
+        seq[i] = c8_get_regs(a)->v[0];
+        TEST_ASSERT_EQUAL_HEX8(seq[i], c8_get_regs(b)->v[0]);
+    }
+
+    /* another seed does not */
+    c8_set_seed(b, 1234);
+    for (i = 0; i < 16; i++)
+    {
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(b));
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(b));
+        same &= seq[i] == c8_get_regs(b)->v[0];
+    }
+    TEST_ASSERT_FALSE(same);
+
+    /* and a saved state carries on with the same numbers */
+    c8_save_state(a, state);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(a));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load_state(b, state));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(b));
+    TEST_ASSERT_EQUAL_HEX8(c8_get_regs(a)->v[0], c8_get_regs(b)->v[0]);
+
+    free(state);
+    c8_destroy(b);
+    c8_destroy(a);
+}
+
+static void test_save_state()
+{
+    c8_t *ctx, *other;
+    uint8_t *state;
+    uint64_t rows[C8_HEIGHT], other_rows[C8_HEIGHT];
+    uint8_t code[] = {
+            0x60, 0x05, // 000: LD V0, 0x05
+            0xF0, 0x29, // 002: LD F, V0
+            0xD0, 0x05, // 004: DRW V0, V0, 5
+            0x70, 0x01, // 006: ADD V0, 0x01
+            0xA1, 0x06, // 008: LD I, 0x106
+            0xF0, 0x55, // 00a: LD [I], V0
+            0x12, 0x34, // 00c: JP 0x234
+    };
+    int i;
+
+    ctx = c8_create();
+    other = c8_create();
+    state = malloc(c8_state_size());
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_NOT_NULL(other);
+    TEST_ASSERT_NOT_NULL(state);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x100, code, sizeof(code)));
+    c8_set_pc(ctx, 0x100);
+    for (i = 0; i < 4; i++)
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    c8_set_keys(ctx, 0x8001);
+    c8_get_regs(ctx)->delay_timer = 7;
+    c8_save_state(ctx, state);
+
+    /* ADD V0 is overwritten by a V0 value of 6: an SYS, then JP 0x234 */
+    for (i = 0; i < 3; i++)
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX8(0x06, c8_get_mem(ctx)[0x106]);
+
+    /* back to the saved point, the original code runs again */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load_state(ctx, state));
+    TEST_ASSERT_EQUAL_HEX16(0x108, c8_get_regs(ctx)->pc);
+    TEST_ASSERT_EQUAL_HEX16(0x19, c8_get_regs(ctx)->i);
+    TEST_ASSERT_EQUAL_HEX8(0x06, c8_get_regs(ctx)->v[0]);
+    TEST_ASSERT_EQUAL(7, c8_get_regs(ctx)->delay_timer);
+    TEST_ASSERT_EQUAL_HEX8(0x70, c8_get_mem(ctx)[0x106]);
+    c8_set_pc(ctx, 0x106);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX8(0x07, c8_get_regs(ctx)->v[0]);
+
+    /* another machine picks up where the first one was saved */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load_state(other, state));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load_state(ctx, state));
+    for (i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(other));
+    }
+    TEST_ASSERT_EQUAL_MEMORY(c8_get_regs(ctx), c8_get_regs(other),
+                             sizeof(c8_regs_t));
+    TEST_ASSERT_EQUAL_MEMORY(c8_get_mem(ctx), c8_get_mem(other), 0x1000);
+    c8_get_display(ctx, rows);
+    c8_get_display(other, other_rows);
+    TEST_ASSERT_EQUAL_MEMORY(rows, other_rows, sizeof(rows));
+
+    /* the layout is little-endian: pc at 8, keys at 44 */
+    TEST_ASSERT_EQUAL_HEX8(0x08, state[8]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, state[9]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, state[44]);
+    TEST_ASSERT_EQUAL_HEX8(0x80, state[45]);
+
+    state[0] ^= 1;
+    TEST_ASSERT_EQUAL(ERR_BAD_STATE, c8_load_state(other, state));
+    free(state);
+    c8_destroy(other);
+    c8_destroy(ctx);
+}
+
+static void test_clone()
+{
+    c8_t *ctx, *copy, *into;
+    void *mem;
+    uint8_t *state, *copy_state;
+    uint8_t code[] = {
+            0xC0, 0x0F, // 000: RND V0, 0x0F
+            0xF0, 0x29, // 002: LD F, V0
+            0xD0, 0x05, // 004: DRW V0, V0, 5
+            0xA1, 0x0E, // 006: LD I, 0x10e
+            0xF0, 0x55, // 008: LD [I], V0
+            0x11, 0x00, // 00a: JP 0x100
+    };
+    int i, n;
+
+    ctx = c8_create();
+    copy = c8_create();
+    mem = malloc(c8_size());
+    state = malloc(c8_state_size());
+    copy_state = malloc(c8_state_size());
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_NOT_NULL(copy);
+    TEST_ASSERT_NOT_NULL(mem);
+    TEST_ASSERT_NOT_NULL(state);
+    TEST_ASSERT_NOT_NULL(copy_state);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x100, code, sizeof(code)));
+    c8_set_pc(ctx, 0x100);
+    c8_set_seed(ctx, 99);
+    for (i = 0; i < 5; i++)
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    c8_set_keys(ctx, 0x0420);
+
+    /* both copies run on exactly like the original */
+    c8_clone(copy, ctx);
+    into = c8_clone_into(mem, ctx);
+    TEST_ASSERT_EQUAL_PTR(mem, into);
+    for (n = 0; n < 3; n++)
+    {
+        for (i = 0; i < 12; i++)
+        {
+            TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+            TEST_ASSERT_EQUAL(ERR_OK, c8_step(copy));
+            TEST_ASSERT_EQUAL(ERR_OK, c8_step(into));
+        }
+        c8_save_state(ctx, state);
+        c8_save_state(copy, copy_state);
+        TEST_ASSERT_EQUAL_MEMORY(state, copy_state, c8_state_size());
+        c8_save_state(into, copy_state);
+        TEST_ASSERT_EQUAL_MEMORY(state, copy_state, c8_state_size());
+        c8_tick_60hz(ctx);
+        c8_tick_60hz(copy);
+        c8_tick_60hz(into);
+    }
+
+    /* and apart from it */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(copy, 0x100, (uint8_t *)"\x00\xE0", 2));
+    TEST_ASSERT_EQUAL_HEX8(0xC0, c8_get_mem(ctx)[0x100]);
+    TEST_ASSERT_EQUAL_HEX8(0xC0, c8_get_mem(into)[0x100]);
+
+    /* cloning again replaces what the copy predecoded in between */
+    c8_set_pc(copy, 0x100);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(copy));
+    c8_clone(copy, ctx);
+    for (i = 0; i < 12; i++)
+    {
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(copy));
+    }
+    c8_save_state(ctx, state);
+    c8_save_state(copy, copy_state);
+    TEST_ASSERT_EQUAL_MEMORY(state, copy_state, c8_state_size());
+
+    /* a machine with the JIT keeps it, translating the new program */
+    if (c8_set_jit(copy, 1) == ERR_OK)
+    {
+        int stop;
+
+        (void)c8_run(copy, 24, &stop);
+        c8_clone(copy, ctx);
+        TEST_ASSERT_NOT_NULL(copy->jit);
+        for (i = 0; i < 8; i++)
+            TEST_ASSERT_EQUAL(c8_run(ctx, 24, &stop),
+                              c8_run(copy, 24, &stop));
+        c8_save_state(ctx, state);
+        c8_save_state(copy, copy_state);
+        TEST_ASSERT_EQUAL_MEMORY(state, copy_state, c8_state_size());
+    }
+
+    free(copy_state);
+    free(state);
+    free(mem);
+    c8_destroy(copy);
+    c8_destroy(ctx);
+}
+
+/*
+ * Run src and a clone of it into dst side by side: fused pairs on either
+ * side of a block that differs must not use slots dst never predecoded.
+ */
+static void clone_and_compare(c8_t *dst, c8_t *src)
+{
+    uint8_t *state = malloc(c8_state_size());
+    uint8_t *dst_state = malloc(c8_state_size());
+    int i, src_stop, dst_stop;
+
+    TEST_ASSERT_NOT_NULL(state);
+    TEST_ASSERT_NOT_NULL(dst_state);
+    c8_clone(dst, src);
+    for (i = 0; i < 8; i++)
+    {
+        TEST_ASSERT_EQUAL(c8_run(src, 4, &src_stop),
+                          c8_run(dst, 4, &dst_stop));
+        TEST_ASSERT_EQUAL(src_stop, dst_stop);
+    }
+    TEST_ASSERT_EQUAL_HEX8(0x55, c8_get_regs(dst)->v[5]);
+    c8_save_state(src, state);
+    c8_save_state(dst, dst_state);
+    TEST_ASSERT_EQUAL_MEMORY(state, dst_state, c8_state_size());
+    free(dst_state);
+    free(state);
+}
+
+static void test_clone_fused_edge()
+{
+    c8_t *src, *dst;
+    int i, stop;
+    uint8_t skip_jp[] = {
+            0x30, 0x00, // 23e: SE V0, 0x00
+            0x12, 0x48, // 240: JP 0x248
+    };
+    uint8_t tail[] = {
+            0x65, 0x55, // 248: LD V5, 0x55
+            0x12, 0x4A, // 24a: JP 0x24a
+    };
+    uint8_t add_skip[] = {
+            0x70, 0x01, // 23c: ADD V0, 0x01
+            0x30, 0x03, // 23e: SE V0, 0x03
+            0x12, 0x3C, // 240: JP 0x23c
+            0x65, 0x55, // 242: LD V5, 0x55
+            0x12, 0x44, // 244: JP 0x244
+    };
+    uint8_t mark = 0xAA;
+
+    /*
+     * The pair at 0x23e ends in the next block, which is the same in both
+     * machines but was never predecoded in dst.
+     */
+    src = c8_create();
+    dst = c8_create();
+    TEST_ASSERT_NOT_NULL(src);
+    TEST_ASSERT_NOT_NULL(dst);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(src, 0x23E, skip_jp, sizeof(skip_jp)));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(src, 0x248, tail, sizeof(tail)));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(dst, 0x240, &skip_jp[2], 2));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(dst, 0x248, tail, sizeof(tail)));
+    c8_get_regs(src)->v[0] = 1;
+    /* the pair is fused once predecoded, on the second time round */
+    for (i = 0; i < 2; i++)
+    {
+        c8_set_pc(src, 0x23E);
+        TEST_ASSERT_EQUAL(2, c8_run(src, 2, &stop));
+    }
+    TEST_ASSERT_EQUAL(1, c8_get_stats(src)->fused);
+    c8_set_pc(src, 0x23E);
+    clone_and_compare(dst, src);
+    c8_destroy(dst);
+    c8_destroy(src);
+
+    /*
+     * The pair at 0x23c in dst ends in a slot of the same block that src
+     * never predecoded, next to a block that differs.
+     */
+    src = c8_create();
+    dst = c8_create();
+    TEST_ASSERT_NOT_NULL(src);
+    TEST_ASSERT_NOT_NULL(dst);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(src, 0x23C, add_skip,
+                                      sizeof(add_skip)));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(src, 0x260, &mark, 1));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(dst, 0x23C, add_skip,
+                                      sizeof(add_skip)));
+    c8_set_pc(dst, 0x23C);
+    TEST_ASSERT_EQUAL(5, c8_run(dst, 5, &stop));
+    TEST_ASSERT_TRUE(c8_get_stats(dst)->fused > 0);
+    c8_set_pc(src, 0x23C);
+    clone_and_compare(dst, src);
+    c8_destroy(dst);
+    c8_destroy(src);
+}
+
+/*
+ * A frame for the rewind tests: fills words 64 bit words of memory at 0x200
+ * with a byte of its own, never 0, so that the delta against the frame
+ * before is a single run of at most that many words.
+ */
+static void rewind_frame(c8_t *ctx, int frame, int words)
+{
+    uint8_t data[64 * 8];
+
+    memset(data, 1 + frame % 255, words * 8);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x200, data, words * 8));
+}
+
+/* ring bytes taken by a delta of one run of words words */
+#define REWIND_ENTRY(words) ((words) * 8 + 2 * sizeof(run_t) + FRAME)
+
+/* walk the ring from the oldest delta to the newest */
+static void rewind_check(rewind_t *rw)
+{
+    size_t at = rw->tail, used = 0;
+    unsigned int n;
+
+    if (rw->wrap)
+    {
+        TEST_ASSERT_TRUE(rw->tail < rw->wrap);
+        TEST_ASSERT_TRUE(rw->head <= rw->tail);
+    }
+    for (n = 0; n < rw->count; n++)
+    {
+        uint32_t size;
+
+        if (rw->wrap && (at == rw->wrap))
+            at = 0;
+        size = size_at(rw, at);
+        TEST_ASSERT_EQUAL(size, size_at(rw, at + sizeof(size) + size));
+        at += size + FRAME;
+        used += size + FRAME;
+    }
+    /* right after a pop the newest delta may end at wrap, with head at 0 */
+    if (rw->wrap && (at == rw->wrap))
+        at = 0;
+    TEST_ASSERT_EQUAL(rw->head, at);
+    TEST_ASSERT_EQUAL(rw->used, used);
+}
+
+/* push the state of ctx, keeping a copy of it on top of states */
+static void rewind_push_saved(rewind_t *rw, c8_t *ctx, uint8_t **states,
+                              int *top)
+{
+    rewind_push(rw, ctx);
+    rewind_check(rw);
+    c8_save_state(ctx, states[++*top]);
+}
+
+/* pop one frame, which must restore the state saved before the top one */
+static void rewind_pop_saved(rewind_t *rw, c8_t *ctx, uint8_t **states,
+                             int *top, uint8_t *state)
+{
+    TEST_ASSERT_EQUAL(0, rewind_pop(rw, ctx));
+    rewind_check(rw);
+    c8_save_state(ctx, state);
+    TEST_ASSERT_EQUAL_MEMORY(states[--*top], state, c8_state_size());
+}
+
+static void test_rewind()
+{
+    enum { STATES = 64 };
+    const size_t capacity = 4 * REWIND_ENTRY(4) + 8;
+    uint8_t *states[STATES + 1], *state;
+    unsigned int count;
+    size_t used;
+    rewind_t *rw;
+    c8_t *ctx;
+    int i, top, frame = 0;
+
+    ctx = c8_create();
+    state = malloc(c8_state_size());
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_NOT_NULL(state);
+    for (i = 0; i <= STATES; i++)
+    {
+        states[i] = malloc(c8_state_size());
+        TEST_ASSERT_NOT_NULL(states[i]);
+    }
+
+    /* a full ring drops its oldest frames: 10 frames, room for 4 deltas */
+    rw = rewind_create(capacity);
+    TEST_ASSERT_NOT_NULL(rw);
+    TEST_ASSERT_EQUAL(-1, rewind_pop(rw, ctx));
+    top = -1;
+    for (i = 0; i < 10; i++)
+    {
+        rewind_frame(ctx, frame++, 4);
+        rewind_push_saved(rw, ctx, states, &top);
+    }
+    rewind_stats(rw, &count, &used);
+    TEST_ASSERT_EQUAL(4, count);
+    TEST_ASSERT_EQUAL(4 * REWIND_ENTRY(4), used);
+    for (i = 0; i < 4; i++)
+        rewind_pop_saved(rw, ctx, states, &top, state);
+    TEST_ASSERT_EQUAL(-1, rewind_pop(rw, ctx));
+    rewind_destroy(rw);
+
+    /*
+     * Down to head 0 with older deltas still in [tail, wrap): the fifth
+     * delta wraps to 0 and drops the first, the next pop leaves head at 0
+     * and the one after that goes on from wrap.
+     */
+    rw = rewind_create(capacity);
+    TEST_ASSERT_NOT_NULL(rw);
+    top = -1;
+    for (i = 0; i < 6; i++)
+    {
+        rewind_frame(ctx, frame++, 4);
+        rewind_push_saved(rw, ctx, states, &top);
+    }
+    TEST_ASSERT_EQUAL(4, rw->count);
+    TEST_ASSERT_EQUAL(REWIND_ENTRY(4), rw->head);
+    TEST_ASSERT_EQUAL(REWIND_ENTRY(4), rw->tail);
+    TEST_ASSERT_EQUAL(4 * REWIND_ENTRY(4), rw->wrap);
+    rewind_pop_saved(rw, ctx, states, &top, state);
+    TEST_ASSERT_EQUAL(0, rw->head);
+    TEST_ASSERT_EQUAL(REWIND_ENTRY(4), rw->tail);
+    TEST_ASSERT_EQUAL(4 * REWIND_ENTRY(4), rw->wrap);
+    rewind_pop_saved(rw, ctx, states, &top, state);
+    TEST_ASSERT_EQUAL(3 * REWIND_ENTRY(4), rw->head);
+    TEST_ASSERT_EQUAL(0, rw->wrap);
+    rewind_pop_saved(rw, ctx, states, &top, state);
+    rewind_pop_saved(rw, ctx, states, &top, state);
+    TEST_ASSERT_EQUAL(-1, rewind_pop(rw, ctx));
+
+    /* a delta bigger than the ring clears it, its state can still be left */
+    for (i = 0; i < 3; i++)
+    {
+        rewind_frame(ctx, frame++, 4);
+        rewind_push_saved(rw, ctx, states, &top);
+    }
+    rewind_frame(ctx, frame++, 40);
+    TEST_ASSERT_TRUE(REWIND_ENTRY(40) > capacity);
+    rewind_push_saved(rw, ctx, states, &top);
+    rewind_stats(rw, &count, &used);
+    TEST_ASSERT_EQUAL(0, count);
+    TEST_ASSERT_EQUAL(0, used);
+    TEST_ASSERT_EQUAL(-1, rewind_pop(rw, ctx));
+    rewind_frame(ctx, frame++, 4);
+    rewind_push_saved(rw, ctx, states, &top);
+    rewind_pop_saved(rw, ctx, states, &top, state);
+    TEST_ASSERT_EQUAL(-1, rewind_pop(rw, ctx));
+    rewind_destroy(rw);
+
+    /* pushes and pops of all sizes, wrapping many times */
+    rw = rewind_create(capacity);
+    TEST_ASSERT_NOT_NULL(rw);
+    top = -1;
+    for (i = 0; i < 400; i++)
+    {
+        if ((i % 7 < 4) || (top < 1))
+        {
+            /* only the newest states can be reached */
+            if (top == STATES)
+            {
+                uint8_t *oldest = states[0];
+
+                memmove(states, states + 1, STATES * sizeof(*states));
+                states[STATES] = oldest;
+                top--;
+            }
+            rewind_frame(ctx, frame++, 1 + i % 5);
+            rewind_push_saved(rw, ctx, states, &top);
+        }
+        else if (rw->count)
+            rewind_pop_saved(rw, ctx, states, &top, state);
+        rewind_stats(rw, &count, &used);
+        TEST_ASSERT_TRUE(used <= capacity);
+    }
+    while (rw->count)
+        rewind_pop_saved(rw, ctx, states, &top, state);
+    rewind_destroy(rw);
+
+    for (i = 0; i <= STATES; i++)
+        free(states[i]);
+    free(state);
+    c8_destroy(ctx);
+}
+
+static void test_render_display()
+{
+    static const uint32_t palette[2] = {0xFF102030, 0xFFC0D0E0};
+    static uint32_t pixels32[C8_HEIGHT][C8_WIDTH + 3];
+    static uint16_t pixels16[C8_HEIGHT][C8_WIDTH];
+    static uint8_t pixels8[C8_HEIGHT][C8_WIDTH + 1];
+    uint64_t rows[C8_HEIGHT];
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x60, 0x05, // 000: LD V0, 0x05
+            0x61, 0x07, // 002: LD V1, 0x07
+            0xA0, 0x32, // 004: LD I, 0x032
+            0xD0, 0x15, // 006: DRW V0, V1, 5
+            0x60, 0x3A, // 008: LD V0, 0x3A
+            0xD0, 0x05, // 00a: DRW V0, V0, 5
+    };
+    int i, x, y;
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x100, code, sizeof(code)));
+    c8_set_pc(ctx, 0x100);
+    for (i = 0; i < 6; i++)
+        TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+
+    c8_get_display(ctx, rows);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_render_display(ctx, pixels32,
+                                                sizeof(pixels32[0]),
+                                                C8_FORMAT_32, palette));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_render_display(ctx, pixels16,
+                                                sizeof(pixels16[0]),
+                                                C8_FORMAT_16, palette));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_render_display(ctx, pixels8,
+                                                sizeof(pixels8[0]),
+                                                C8_FORMAT_8, palette));
+    for (y = 0; y < C8_HEIGHT; y++)
+    {
+        for (x = 0; x < C8_WIDTH; x++)
+        {
+            uint8_t on = c8_get_pixel(ctx, x, y);
+
+            TEST_ASSERT_EQUAL(on, (rows[y] >> (63 - x)) & 1);
+            TEST_ASSERT_EQUAL_HEX32(palette[on], pixels32[y][x]);
+            TEST_ASSERT_EQUAL_HEX16(palette[on] & 0xFFFF, pixels16[y][x]);
+            TEST_ASSERT_EQUAL_HEX8(palette[on] & 0xFF, pixels8[y][x]);
+        }
+        /* padding at the end of a line is left alone */
+        TEST_ASSERT_EQUAL_HEX32(0, pixels32[y][C8_WIDTH]);
+        TEST_ASSERT_EQUAL_HEX8(0, pixels8[y][C8_WIDTH]);
+    }
+    TEST_ASSERT_EQUAL(1, c8_get_pixel(ctx, 7, 7));
+    TEST_ASSERT_EQUAL(1, c8_get_pixel(ctx, 58, 26));
+
+    TEST_ASSERT_EQUAL(ERR_NOT_SUPPORTED,
+                      c8_render_display(ctx, pixels32, sizeof(pixels32[0]),
+                                        3, palette));
+    c8_destroy(ctx);
+}
+
+static void test_run()
+{
+    int reason;
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x60, 0x01, // 000: LD V0, 0x01
+            0x61, 0x02, // 002: LD V1, 0x02
+            0x00, 0xE0, // 004: CLS
+            0x70, 0x01, // 006: ADD V0, 0x01
+            0xD0, 0x15, // 008: DRW V0, V1, 5
+            0xF1, 0x18, // 00a: LD ST, V1
+            0xF1, 0x18, // 00c: LD ST, V1
+            0xF2, 0x0A, // 00e: LD V2, K
+            0x10, 0x12, // 010: JP 0x012
+            0x10, 0x12, // 012: JP 0x012
+    };
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0, code, sizeof(code)));
+
+    TEST_ASSERT_EQUAL(0, c8_run(ctx, 0, &reason));
+    TEST_ASSERT_EQUAL(STOP_BUDGET, reason);
+    TEST_ASSERT_EQUAL(2, c8_run(ctx, 2, &reason));
+    TEST_ASSERT_EQUAL(STOP_BUDGET, reason);
+    TEST_ASSERT_EQUAL(4, ctx->reg.pc);
+
+    TEST_ASSERT_EQUAL(1, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_DISPLAY, reason);
+    TEST_ASSERT_EQUAL(2, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_DISPLAY, reason);
+    TEST_ASSERT_EQUAL(0xA, ctx->reg.pc);
+
+    /* only a sound timer going from zero to non-zero counts */
+    TEST_ASSERT_EQUAL(1, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_SOUND, reason);
+    TEST_ASSERT_EQUAL(2, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_KEY_WAIT, reason);
+    TEST_ASSERT_EQUAL(0xE, ctx->reg.pc);
+    TEST_ASSERT_EQUAL(0, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_HALTED, reason);
+    TEST_ASSERT_EQUAL(0xE, ctx->reg.pc);
+
+    c8_set_keys(ctx, BIT(5));
+    TEST_ASSERT_EQUAL(3, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_INFINIT_LOOP, reason);
+    TEST_ASSERT_EQUAL_HEX8(5, ctx->reg.v[2]);
+    TEST_ASSERT_EQUAL(0x12, ctx->reg.pc);
+    TEST_ASSERT_EQUAL(0, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_HALTED, reason);
+
+    c8_set_pc(ctx, 0x300);
+    TEST_ASSERT_EQUAL(0, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_INVALID_OP, reason);
+    TEST_ASSERT_EQUAL(0x300, ctx->reg.pc);
+}
+
+static void test_fusion()
+{
+    int reason;
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x60, 0x00, // 000: LD V0, 0x00
+            0x70, 0x01, // 002: ADD V0, 0x01
+            0x30, 0x05, // 004: SE V0, 0x05
+            0x10, 0x02, // 006: JP 0x002
+            0xA0, 0x00, // 008: LD I, 0x000
+            0xD1, 0x15, // 00a: DRW V1, V1, 5
+            0x10, 0x0C, // 00c: JP 0x00C
+    };
+    uint8_t patch[] = {
+            0x40, 0x05, // SNE V0, 0x05
+    };
+    uint64_t fused;
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0, code, sizeof(code)));
+
+    /* the first round predecodes, the following ones run fused */
+    TEST_ASSERT_EQUAL(17, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_DISPLAY, reason);
+    TEST_ASSERT_EQUAL_HEX8(5, ctx->reg.v[0]);
+    TEST_ASSERT_EQUAL(0xC, ctx->reg.pc);
+    TEST_ASSERT_EQUAL(0xA, ctx->last.pc);
+    TEST_ASSERT_EQUAL_HEX16(0xD115, ctx->last.op);
+    TEST_ASSERT_TRUE(c8_get_stats(ctx)->fused > 0);
+
+    /* a pair never runs past the budget */
+    fused = c8_get_stats(ctx)->fused;
+    ctx->reg.v[0] = 0;
+    c8_set_pc(ctx, 2);
+    TEST_ASSERT_EQUAL(1, c8_run(ctx, 1, &reason));
+    TEST_ASSERT_EQUAL(4, ctx->reg.pc);
+    TEST_ASSERT_EQUAL(fused, c8_get_stats(ctx)->fused);
+
+    /* last.pc and last.op describe the second half */
+    c8_set_pc(ctx, 2);
+    TEST_ASSERT_EQUAL(2, c8_run(ctx, 2, &reason));
+    TEST_ASSERT_EQUAL(STOP_BUDGET, reason);
+    TEST_ASSERT_EQUAL(6, ctx->reg.pc);
+    TEST_ASSERT_EQUAL(4, ctx->last.pc);
+    TEST_ASSERT_EQUAL_HEX16(0x3005, ctx->last.op);
+    TEST_ASSERT_EQUAL(fused + 1, c8_get_stats(ctx)->fused);
+
+    /* rewriting the second half splits the pair */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 4, patch, sizeof(patch)));
+    ctx->reg.v[0] = 0;
+    c8_set_pc(ctx, 2);
+    TEST_ASSERT_EQUAL(2, c8_run(ctx, 2, &reason));
+    TEST_ASSERT_EQUAL(8, ctx->reg.pc);
+
+    /* a fused jump to itself still stops the run */
+    c8_set_pc(ctx, 0xC);
+    TEST_ASSERT_EQUAL(1, c8_run(ctx, 100, &reason));
+    TEST_ASSERT_EQUAL(STOP_INFINIT_LOOP, reason);
+    c8_destroy(ctx);
+}
+
+static void test_idle()
+{
+    int reason, wake;
+    uint64_t skipped;
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x60, 0x03, // 000: LD V0, 0x03
+            0xF0, 0x15, // 002: LD DT, V0
+            0xF1, 0x07, // 004: LD V1, DT
+            0x31, 0x00, // 006: SE V1, 0x00
+            0x10, 0x04, // 008: JP 0x004
+            0x10, 0x0A, // 00a: JP 0x00A
+            0xC2, 0x00, // 00c: RND V2, 0x00
+            0x10, 0x0C, // 00e: JP 0x00C
+    };
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0, code, sizeof(code)));
+
+    /* two rounds to find the loop idle, one to time it, then 329 skipped */
+    TEST_ASSERT_EQUAL(1000, c8_run(ctx, 1000, &reason));
+    TEST_ASSERT_EQUAL(STOP_BUDGET, reason);
+    TEST_ASSERT_EQUAL(987, c8_get_stats(ctx)->idle_skipped);
+    TEST_ASSERT_EQUAL(8, ctx->reg.pc);
+    TEST_ASSERT_EQUAL(6, ctx->last.pc);
+    TEST_ASSERT_EQUAL_HEX8(3, ctx->reg.v[1]);
+
+    /* then halts until the timer ticks or a key changes */
+    TEST_ASSERT_TRUE(c8_halted(ctx, &wake));
+    TEST_ASSERT_EQUAL(WAKE_TIMER | WAKE_KEY, wake);
+    TEST_ASSERT_EQUAL(0, c8_run(ctx, 1000, &reason));
+    TEST_ASSERT_EQUAL(STOP_HALTED, reason);
+    TEST_ASSERT_EQUAL(ERR_HALTED, c8_step(ctx));
+    c8_set_keys(ctx, 0);
+    TEST_ASSERT_TRUE(c8_halted(ctx, NULL));
+    c8_set_keys(ctx, BIT(1));
+    TEST_ASSERT_FALSE(c8_halted(ctx, NULL));
+    TEST_ASSERT_EQUAL(1000, c8_run(ctx, 1000, &reason));
+    TEST_ASSERT_TRUE(c8_halted(ctx, NULL));
+    TEST_ASSERT_EQUAL(4, ctx->reg.pc);
+
+    /* the timer running out ends the wait */
+    c8_tick_60hz(ctx);
+    TEST_ASSERT_FALSE(c8_halted(ctx, NULL));
+    c8_tick_60hz(ctx);
+    c8_tick_60hz(ctx);
+    TEST_ASSERT_EQUAL(3, c8_run(ctx, 1000, &reason));
+    TEST_ASSERT_EQUAL(STOP_INFINIT_LOOP, reason);
+    TEST_ASSERT_EQUAL(0xA, ctx->reg.pc);
+
+    /* a jump to itself halts for good */
+    TEST_ASSERT_TRUE(c8_halted(ctx, &wake));
+    TEST_ASSERT_EQUAL(WAKE_NONE, wake);
+    c8_tick_60hz(ctx);
+    c8_set_keys(ctx, 0);
+    TEST_ASSERT_TRUE(c8_halted(ctx, NULL));
+
+    /* a loop calling RND is never idle */
+    c8_set_pc(ctx, 0xC);
+    TEST_ASSERT_FALSE(c8_halted(ctx, NULL));
+    skipped = c8_get_stats(ctx)->idle_skipped;
+    TEST_ASSERT_EQUAL(1000, c8_run(ctx, 1000, &reason));
+    TEST_ASSERT_EQUAL(skipped, c8_get_stats(ctx)->idle_skipped);
+    TEST_ASSERT_FALSE(c8_halted(ctx, NULL));
+    c8_destroy(ctx);
+}
+
+/* build a random loop out of the instructions the JIT translates */
+static unsigned int jit_program(uint8_t *code, unsigned int seed)
+{
+    static const uint16_t templates[] = {
+            0x6000, 0x7000, 0x8000, 0x8001, 0x8002, 0x8003, 0x8004,
+            0x8005, 0x8006, 0x8007, 0x800E, 0xA000, 0xF01E, 0xF029,
+            0xF007, 0xF015, 0xF065, 0x3000, 0x4000, 0x5000, 0x9000,
+    };
+    unsigned int n = 0, i, adds = 0;
+
+    code[n++] = 0xA3; // LD I, 0x300
+    code[n++] = 0x00;
+    for (i = 0; i < 40; i++)
+    {
+        uint16_t op;
+
+        seed = seed * 1103515245 + 12345;
+        op = templates[(seed >> 16) % (sizeof(templates) / sizeof(*templates))];
+        seed = seed * 1103515245 + 12345;
+        if ((op & 0xF000) == 0xA000)
+            op |= 0x200 + ((seed >> 16) & 0x5FF);
+        else if ((op & 0xF0FF) == 0xF01E && adds++ > 3)
+            op = 0x6000 | ((seed >> 16) & 0xFFF);
+        else if ((op & 0xF000) == 0x8000 || (op & 0xF000) == 0x5000 ||
+                 (op & 0xF000) == 0x9000)
+            op |= (seed >> 16) & 0x0FF0;
+        else if ((op & 0xF000) == 0xF000)
+            op |= (seed >> 16) & 0x0F00;
+        else
+            op |= (seed >> 16) & 0x0FFF;
+        code[n++] = op >> 8;
+        code[n++] = op & 0xFF;
+    }
+    code[n++] = 0x12; // JP 0x200
+    code[n++] = 0x00;
+    return n;
+}
+
+static void test_jit()
+{
+    unsigned int seed, i, size;
+    c8_t *ref, *jit;
+    uint8_t code[128];
+
+    for (seed = 1; seed < 50; seed++)
+    {
+        ref = c8_create();
+        jit = c8_create();
+        TEST_ASSERT_NOT_NULL(ref);
+        TEST_ASSERT_NOT_NULL(jit);
+        if (c8_set_jit(jit, 1) == ERR_NOT_SUPPORTED)
+        {
+            c8_destroy(ref);
+            c8_destroy(jit);
+            TEST_IGNORE_MESSAGE("JIT not supported on this host");
+        }
+
+        size = jit_program(code, seed);
+        TEST_ASSERT_EQUAL(ERR_OK, c8_load(ref, 0x200, code, size));
+        TEST_ASSERT_EQUAL(ERR_OK, c8_load(jit, 0x200, code, size));
+        c8_set_pc(ref, 0x200);
+        c8_set_pc(jit, 0x200);
+        ref->reg.delay_timer = jit->reg.delay_timer = seed;
+
+        for (i = 0; i < 2000; i++)
+        {
+            unsigned int budget = 1 + (i * seed) % 37;
+            int ref_stop, jit_stop;
+
+            TEST_ASSERT_EQUAL(c8_run(ref, budget, &ref_stop),
+                              c8_run(jit, budget, &jit_stop));
+            TEST_ASSERT_EQUAL(ref_stop, jit_stop);
+            TEST_ASSERT_EQUAL_MEMORY(&ref->reg, &jit->reg, sizeof(ref->reg));
+            TEST_ASSERT_EQUAL_HEX16(ref->last.pc, jit->last.pc);
+            TEST_ASSERT_EQUAL_HEX16(ref->last.op, jit->last.op);
+        }
+        TEST_ASSERT_EQUAL_MEMORY(ref->mem, jit->mem, MEM_SIZE);
+
+        c8_destroy(ref);
+        c8_destroy(jit);
+    }
+}
+
+static void test_jit_long_blocks()
+{
+    unsigned int pc, k;
+    c8_t *ref, *jit;
+    uint8_t code[0x800], data[0x500];
+
+    ref = c8_create();
+    jit = c8_create();
+    TEST_ASSERT_NOT_NULL(ref);
+    TEST_ASSERT_NOT_NULL(jit);
+    if (c8_set_jit(jit, 1) == ERR_NOT_SUPPORTED)
+    {
+        c8_destroy(ref);
+        c8_destroy(jit);
+        TEST_IGNORE_MESSAGE("JIT not supported on this host");
+    }
+
+    /* LD VF, [I] has the largest translation, LD [I], VF ends a block */
+    for (k = 0; k < sizeof(code); k += 2)
+    {
+        code[k] = 0xFF;
+        code[k + 1] = (k % 200 == 198) ? 0x55 : 0x65;
+    }
+    for (k = 0; k < sizeof(data); k++)
+        data[k] = k * 7 + 3;
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ref, 0x200, code, sizeof(code)));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(jit, 0x200, code, sizeof(code)));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ref, 0xA00, data, sizeof(data)));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(jit, 0xA00, data, sizeof(data)));
+
+    /* a fresh block at every address, far more code than the cache holds */
+    for (pc = 0x200; pc < 0xA00; pc += 2)
+    {
+        int ref_stop, jit_stop;
+
+        c8_set_pc(ref, pc);
+        c8_set_pc(jit, pc);
+        ref->reg.i = jit->reg.i = 0xA00;
+        TEST_ASSERT_EQUAL(c8_run(ref, 64, &ref_stop),
+                          c8_run(jit, 64, &jit_stop));
+        TEST_ASSERT_EQUAL(ref_stop, jit_stop);
+        TEST_ASSERT_EQUAL_MEMORY(&ref->reg, &jit->reg, sizeof(ref->reg));
+        TEST_ASSERT_EQUAL_HEX16(ref->last.pc, jit->last.pc);
+        TEST_ASSERT_EQUAL_HEX16(ref->last.op, jit->last.op);
+    }
+    TEST_ASSERT_EQUAL_MEMORY(ref->mem, jit->mem, MEM_SIZE);
+
+    c8_destroy(ref);
+    c8_destroy(jit);
+}
+
+static void test_jit_flush()
+{
+    unsigned int i, k, size, flushes = 0;
+    size_t used;
+    c8_t *ref, *jit;
+    uint8_t code[128], filler[0x7FE];
+
+    ref = c8_create();
+    jit = c8_create();
+    TEST_ASSERT_NOT_NULL(ref);
+    TEST_ASSERT_NOT_NULL(jit);
+    if (c8_set_jit(jit, 1) == ERR_NOT_SUPPORTED)
+    {
+        c8_destroy(ref);
+        c8_destroy(jit);
+        TEST_IGNORE_MESSAGE("JIT not supported on this host");
+    }
+
+    size = jit_program(code, 7);
+    for (k = 0; k < sizeof(filler); k += 2)
+    {
+        filler[k] = 0xFF; // LD VF, [I]
+        filler[k + 1] = 0x65;
+    }
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ref, 0x200, code, size));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(jit, 0x200, code, size));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(jit, 0x800, filler, sizeof(filler)));
+    c8_set_pc(ref, 0x200);
+    c8_set_pc(jit, 0x200);
+    TEST_ASSERT_EQUAL(500, c8_run(ref, 500, NULL));
+    TEST_ASSERT_EQUAL(500, c8_run(jit, 500, NULL));
+    TEST_ASSERT_TRUE(jit->jit->block[0x200].compiled);
+
+    /* compile blocks until the cache runs full and is flushed */
+    for (k = 0x800; !flushes && (k < 0x1000); k += 2)
+    {
+        used = jit->jit->used;
+        c8_set_pc(jit, k);
+        jit->reg.i = 0x300;
+        c8_run(jit, 64, NULL);
+        if (jit->jit->used < used)
+            flushes++;
+    }
+    TEST_ASSERT_EQUAL(1, flushes);
+    TEST_ASSERT_FALSE(jit->jit->block[0x200].compiled);
+
+    /* the loop is compiled again and still runs like the interpreter */
+    memcpy(&jit->reg, &ref->reg, sizeof(ref->reg));
+    for (i = 0; i < 2000; i++)
+    {
+        unsigned int budget = 1 + (i * 7) % 37;
+        int ref_stop, jit_stop;
+
+        TEST_ASSERT_EQUAL(c8_run(ref, budget, &ref_stop),
+                          c8_run(jit, budget, &jit_stop));
+        TEST_ASSERT_EQUAL(ref_stop, jit_stop);
+        TEST_ASSERT_EQUAL_MEMORY(&ref->reg, &jit->reg, sizeof(ref->reg));
+        TEST_ASSERT_EQUAL_HEX16(ref->last.pc, jit->last.pc);
+        TEST_ASSERT_EQUAL_HEX16(ref->last.op, jit->last.op);
+    }
+    TEST_ASSERT_TRUE(jit->jit->block[0x200].compiled);
+    TEST_ASSERT_EQUAL_MEMORY(ref->mem, jit->mem, 0x800);
+
+    c8_destroy(ref);
+    c8_destroy(jit);
+}
+
+static void test_jit_self_modifying()
+{
+    int stop;
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x7a, 0x01, // 200: ADD VA, 0x01
+            0x7b, 0x01, // 202: ADD VB, 0x01
+            0x3a, 0x10, // 204: SE VA, 0x10
+            0x12, 0x00, // 206: JP 0x200
+            0x60, 0x72, // 208: LD V0, 0x72
+            0x61, 0x02, // 20a: LD V1, 0x02
+            0xa2, 0x02, // 20c: LD I, 0x202
+            0xf1, 0x55, // 20e: LD [I], V1
+            0x6a, 0x00, // 210: LD VA, 0x00
+            0x12, 0x00, // 212: JP 0x200
+    };
+    uint8_t patch[] = {
+            0x7b, 0x03, // ADD VB, 0x03
+    };
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    if (c8_set_jit(ctx, 1) == ERR_NOT_SUPPORTED)
+    {
+        c8_destroy(ctx);
+        TEST_IGNORE_MESSAGE("JIT not supported on this host");
+    }
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x200, code, sizeof(code)));
+    c8_set_pc(ctx, 0x200);
+
+    /* 15 rounds of 4, the last round of 3, then 202 becomes ADD V2, 0x02 */
+    TEST_ASSERT_EQUAL(69, c8_run(ctx, 69, &stop));
+    TEST_ASSERT_EQUAL(STOP_BUDGET, stop);
+    TEST_ASSERT_EQUAL_HEX8(0x10, ctx->reg.v[0xb]);
+    TEST_ASSERT_EQUAL(0x200, ctx->reg.pc);
+    TEST_ASSERT_EQUAL_HEX8(0x72, ctx->mem[0x202]);
+
+    TEST_ASSERT_EQUAL(4, c8_run(ctx, 4, &stop));
+    TEST_ASSERT_EQUAL_HEX8(0x01, ctx->reg.v[0xa]);
+    TEST_ASSERT_EQUAL_HEX8(0x10, ctx->reg.v[0xb]);
+    TEST_ASSERT_EQUAL_HEX8(0x02, ctx->reg.v[2]);
+
+    /* the host patches the block */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x202, patch, sizeof(patch)));
+    TEST_ASSERT_EQUAL(4, c8_run(ctx, 4, &stop));
+    TEST_ASSERT_EQUAL_HEX8(0x13, ctx->reg.v[0xb]);
+    TEST_ASSERT_EQUAL_HEX16(0x1200, ctx->last.op);
+    TEST_ASSERT_EQUAL_HEX16(0x206, ctx->last.pc);
+
+    /* switching the JIT off keeps the state */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_set_jit(ctx, 0));
+    TEST_ASSERT_EQUAL(4, c8_run(ctx, 4, &stop));
+    TEST_ASSERT_EQUAL_HEX8(0x16, ctx->reg.v[0xb]);
+    c8_destroy(ctx);
+}
+
+static void test_disasm()
+{
+    c8_t *ctx;
+    uint8_t code[] = {
+            0xD1, 0x2F, // 000: DRW V1, V2, 0xF
+            0xC3, 0x0F, // 002: RND V3, 0x0F
+            0xF4, 0x29, // 004: LD I, FONT(V4)
+            0x00, 0xE0, // 006: CLS
+            0xF0, 0x00, // 008: invalid
+    };
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0, code, sizeof(code)));
+
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_STRING("DRW\tV1,\tV2,\t0xF", last_opstr(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_STRING("RND\tV3,\t0xF", last_opstr(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_STRING("LD\tI,\tFONT(V4)", last_opstr(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_STRING("CLS", last_opstr(ctx));
+    TEST_ASSERT_EQUAL(ERR_INVALID_OP, c8_step(ctx));
+    TEST_ASSERT_EQUAL_STRING("", last_opstr(ctx));
+}
+
+static void test_self_modifying()
+{
+    c8_t *ctx;
+    uint8_t code[] = {
+            0x60, 0x11, // 000: LD V0, 0x11
+            0x61, 0x61, // 002: LD V1, 0x61
+            0x62, 0x22, // 004: LD V2, 0x22
+            0xa0, 0x00, // 006: LD I, 0x000
+            0xf2, 0x55, // 008: LD [I], V2
+            0x10, 0x00, // 00a: JP 0x000
+    };
+    uint8_t patch[] = {
+            0x63, 0x44, // LD V3, 0x44
+    };
+
+    ctx = c8_create();
+    TEST_ASSERT_NOT_NULL(ctx);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0, code, sizeof(code)));
+
+    /* first pass rewrites 000 into 1161 (JP 0x161) and leaves 22 at 002 */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(0, ctx->reg.pc);
+
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX16(0x1161, ctx->last.op);
+    TEST_ASSERT_EQUAL(0x161, ctx->reg.pc);
+
+    /* the odd slot 001 covers bytes written at 002 */
+    c8_set_pc(ctx, 1);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX16(0x6122, ctx->last.op);
+    TEST_ASSERT_EQUAL_HEX8(0x22, ctx->reg.v[1]);
+
+    /* host writes through c8_load */
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0, patch, sizeof(patch)));
+    c8_set_pc(ctx, 0);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX8(0x44, ctx->reg.v[3]);
+
+    /* LD B, Vx */
+    code[0] = 0x60; code[1] = 0xff; // LD V0, 0xff
+    code[2] = 0xf0; code[3] = 0x33; // LD B, V0
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x100, code, 4));
+    TEST_ASSERT_EQUAL(ERR_OK, c8_load(ctx, 0x104, patch, sizeof(patch)));
+    c8_set_pc(ctx, 0x104);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX16(0x6344, ctx->last.op);
+    c8_set_pc(ctx, 0x100);
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    ctx->reg.i = 0x104;
+    TEST_ASSERT_EQUAL(ERR_OK, c8_step(ctx));
+    TEST_ASSERT_EQUAL(ERR_INVALID_OP, c8_step(ctx));
+    TEST_ASSERT_EQUAL_HEX16(0x0205, ctx->last.op);
+}
+
 static void test_op_keyboard()
 {
     c8_t *ctx;
@@ -597,6 +1986,7 @@ int main(int argc, char **argv)
     UnityBegin("c8 test suite");
     RUN_TEST(test_load);
     RUN_TEST(test_op_invalid);
+    RUN_TEST(test_op_invalid_groups);
     RUN_TEST(test_op_JP_addr);
     RUN_TEST(test_op_skip);
     RUN_TEST(test_op_LD_Vx_byte);
@@ -609,6 +1999,26 @@ int main(int argc, char **argv)
     RUN_TEST(test_op_Fxxx_push_pop);
     RUN_TEST(test_op_Fxxx_misc);
     RUN_TEST(test_op_keyboard);
+    RUN_TEST(test_op_LD_Vx_K);
+    RUN_TEST(test_op_DRW);
+    RUN_TEST(test_display_generation);
+    RUN_TEST(test_render_display);
+    RUN_TEST(test_dirty_rect);
+    RUN_TEST(test_draw_callback);
+    RUN_TEST(test_save_state);
+    RUN_TEST(test_rng);
+    RUN_TEST(test_clone);
+    RUN_TEST(test_clone_fused_edge);
+    RUN_TEST(test_rewind);
+    RUN_TEST(test_run);
+    RUN_TEST(test_fusion);
+    RUN_TEST(test_idle);
+    RUN_TEST(test_jit);
+    RUN_TEST(test_jit_long_blocks);
+    RUN_TEST(test_jit_flush);
+    RUN_TEST(test_jit_self_modifying);
+    RUN_TEST(test_disasm);
+    RUN_TEST(test_self_modifying);
     UnityEnd();
 
     return 0;